@@ -0,0 +1,179 @@
+#pragma once
+#include "bitstring.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace ict {
+// An interning pool: equal bits share one immutable, reference counted
+// payload, so memory grows with the number of distinct payloads rather than
+// the number of copies.
+//
+//     ict::bitpool pool;
+//     auto id = pool.intern(is.read_view(64)); // shared_ptr<const bitstring>
+//
+// The pool is split into shards by hash, each with its own reader/writer lock,
+// so concurrent lookups of payloads that are already there only take shared
+// locks.  Payloads are always allocated with global operator new, never from
+// the calling thread's bitstring_resource(), since they outlive any arena.
+class bitpool {
+  public:
+    using handle = std::shared_ptr<const bitstring>;
+
+    struct statistics {
+        uint64_t lookups;   // calls to intern()
+        uint64_t hits;      // of which found an existing payload
+        size_t payloads;    // distinct payloads held
+        size_t bytes;       // bytes of bits held by those payloads
+
+        double hit_rate() const {
+            return lookups ? static_cast<double>(hits) / lookups : 0.0;
+        }
+    };
+
+    explicit bitpool(size_t shards = 16) : shards_(shards) {
+        if (!shards)
+            IT_PANIC("a bitpool needs at least one shard");
+    }
+
+    bitpool(const bitpool &) = delete;
+    bitpool &operator=(const bitpool &) = delete;
+
+    // The shared payload equal to bits, added if it isn't there yet.
+    handle intern(const bitstring_view &bits) {
+        auto h = hash(bits);
+        auto &s = shard_for(h);
+        s.lookups.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::shared_lock<std::shared_mutex> lock(s.mutex);
+            if (auto p = s.find(h, bits)) {
+                s.hits.fetch_add(1, std::memory_order_relaxed);
+                return p;
+            }
+        }
+        bitstring copy(bits.bit_size(), nullptr);
+        bit_copy_n(bits.bit_begin(), bits.bit_size(), copy.bit_begin());
+        return s.insert(h, std::move(copy));
+    }
+
+    // The same, taking over the storage of bits when they are added.
+    handle intern(bitstring &&bits) {
+        auto h = hash(bits);
+        auto &s = shard_for(h);
+        s.lookups.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::shared_lock<std::shared_mutex> lock(s.mutex);
+            if (auto p = s.find(h, bits)) {
+                s.hits.fetch_add(1, std::memory_order_relaxed);
+                return p;
+            }
+        }
+        if (bits.resource())
+            return s.insert(h, bitstring(bits, nullptr));
+        return s.insert(h, std::move(bits));
+    }
+
+    // The payload equal to bits, or nullptr.  Not counted as a lookup.
+    handle find(const bitstring_view &bits) const {
+        auto h = hash(bits);
+        auto &s = shard_for(h);
+        std::shared_lock<std::shared_mutex> lock(s.mutex);
+        return s.find(h, bits);
+    }
+
+    // Drop the payloads nothing outside the pool refers to, returning how
+    // many went.
+    size_t release_unused() {
+        size_t n = 0;
+        for (auto &s : shards_) {
+            std::unique_lock<std::shared_mutex> lock(s.mutex);
+            for (auto i = s.map.begin(); i != s.map.end();) {
+                // nobody can take a new reference while the lock is held
+                if (i->second.use_count() == 1) {
+                    s.bytes -= i->second->byte_size();
+                    i = s.map.erase(i);
+                    ++n;
+                } else {
+                    ++i;
+                }
+            }
+        }
+        return n;
+    }
+
+    // Forget every payload.  Handles already given out stay valid.
+    void clear() {
+        for (auto &s : shards_) {
+            std::unique_lock<std::shared_mutex> lock(s.mutex);
+            s.map.clear();
+            s.bytes = 0;
+        }
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (auto &s : shards_) {
+            std::shared_lock<std::shared_mutex> lock(s.mutex);
+            n += s.map.size();
+        }
+        return n;
+    }
+
+    statistics stats() const {
+        statistics st{0, 0, 0, 0};
+        for (auto &s : shards_) {
+            st.lookups += s.lookups.load(std::memory_order_relaxed);
+            st.hits += s.hits.load(std::memory_order_relaxed);
+            std::shared_lock<std::shared_mutex> lock(s.mutex);
+            st.payloads += s.map.size();
+            st.bytes += s.bytes;
+        }
+        return st;
+    }
+
+  private:
+    // Each shard on its own cache lines so the counters of one don't slow
+    // down lookups in another.
+    struct alignas(64) shard {
+        // the caller holds the lock, shared or not
+        handle find(uint64_t h, const bitstring_view &bits) const {
+            auto range = map.equal_range(h);
+            for (auto i = range.first; i != range.second; ++i)
+                if (bitstring_view(*i->second) == bits)
+                    return i->second;
+            return nullptr;
+        }
+
+        handle insert(uint64_t h, bitstring &&bits) {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            // someone else may have added it since the shared lock was let go
+            if (auto p = find(h, bits)) {
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return p;
+            }
+            auto p = std::make_shared<const bitstring>(std::move(bits));
+            bytes += p->byte_size();
+            map.emplace(h, p);
+            return p;
+        }
+
+        mutable std::shared_mutex mutex;
+        std::unordered_multimap<uint64_t, handle> map;
+        size_t bytes = 0;
+        std::atomic<uint64_t> lookups{0};
+        std::atomic<uint64_t> hits{0};
+    };
+
+    shard &shard_for(uint64_t h) {
+        return shards_[(h >> 32) % shards_.size()];
+    }
+    const shard &shard_for(uint64_t h) const {
+        return shards_[(h >> 32) % shards_.size()];
+    }
+
+    std::vector<shard> shards_;
+};
+} // namespace ict
@@ -1,8 +1,39 @@
 #pragma once
 #include "ict.h"
 #include <cassert>
+#include <cstdint>
+#include <functional>
 #include <limits.h>
+#include <memory>
+#include <new>
 #include <random>
+#include <type_traits>
+
+#if defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#endif
+
+#if defined(__cpp_lib_memory_resource)
+#define ICT_HAS_PMR 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ICT_HAS_SSE2 1
+#endif
+
+// Bytes of bits a bitstring stores inline before going to the heap.  It must
+// be at least the size of a pointer.
+#ifndef ICT_BITSTRING_LOCAL_BYTES
+#define ICT_BITSTRING_LOCAL_BYTES 16
+#endif
 
 namespace ict {
 
@@ -25,12 +56,15 @@ template <typename Char> inline bool get_bit(Char *buf, size_t index) {
 }
 
 namespace detail {
-// bit proxy type
+// bit proxy type.  The bit offset is always kept in the range 0 to 7 so the
+// byte pointer can be used directly and all arithmetic is O(1).
 struct bit_proxy {
     bit_proxy() : byte_(nullptr), bit_(0) {}
     bit_proxy(char *byte, size_t bit)
-        : byte_(reinterpret_cast<unsigned char *>(byte)), bit_(bit) {}
-    bit_proxy(unsigned char *byte, size_t bit) : byte_(byte), bit_(bit) {}
+        : byte_(reinterpret_cast<unsigned char *>(byte) + bit / 8),
+          bit_(bit % 8) {}
+    bit_proxy(unsigned char *byte, size_t bit)
+        : byte_(byte + bit / 8), bit_(bit % 8) {}
 
     bool value() const { return get_bit(byte_, bit_); }
 
@@ -38,13 +72,17 @@ struct bit_proxy {
     void value(const bit_proxy &x) { set_bit(byte_, bit_, x.value()); }
 
     void increment() {
-        ++bit_;
-        normalize();
+        if (bit_ == 7) {
+            bit_ = 0;
+            ++byte_;
+        } else
+            ++bit_;
     }
 
     void increment(size_t n) {
-        bit_ += n;
-        normalize();
+        n += bit_;
+        byte_ += n / 8;
+        bit_ = n % 8;
     }
 
     void decrement() {
@@ -57,51 +95,45 @@ struct bit_proxy {
     }
 
     void decrement(size_t n) {
-        // TODO implement as O(1)
-        for (size_t i = 0; i < n; ++i)
-            decrement();
+        // borrow whole bytes so the bit offset never goes negative
+        n += 7 - bit_;
+        byte_ -= n / 8;
+        bit_ = 7 - n % 8;
+    }
+
+    void advance(std::ptrdiff_t n) {
+        if (n < 0)
+            decrement(static_cast<size_t>(-n));
+        else
+            increment(static_cast<size_t>(n));
     }
 
     std::ptrdiff_t difference(const bit_proxy &b) const {
-        auto bytes = byte_ - b.byte_;
-        auto bits = bit_ - b.bit_;
-        return (bytes * 8) + bits;
+        return (byte_ - b.byte_) * 8 + (static_cast<std::ptrdiff_t>(bit_) -
+                                        static_cast<std::ptrdiff_t>(b.bit_));
     }
 
     bool identical(const bit_proxy &b) const {
-        normalize();
-        b.normalize();
         return byte_ == b.byte_ && bit_ == b.bit_;
     }
 
-    unsigned char *get_byte() {
-        normalize();
-        return byte_;
+    bool before(const bit_proxy &b) const {
+        return byte_ < b.byte_ || (byte_ == b.byte_ && bit_ < b.bit_);
     }
 
-    const unsigned char *get_byte() const {
-        normalize();
-        return byte_;
-    }
+    unsigned char *get_byte() { return byte_; }
 
-    unsigned char *get_unsigned_byte() { return get_byte(); }
+    const unsigned char *get_byte() const { return byte_; }
 
-    const unsigned char *get_unsigned_byte() const {
-        return const_cast<unsigned char *>(get_byte());
-    }
+    unsigned char *get_unsigned_byte() { return byte_; }
+
+    const unsigned char *get_unsigned_byte() const { return byte_; }
 
     size_t bit() const { return bit_; }
 
   private:
-    void normalize() const {
-        if (bit_ > 7) {
-            byte_ += bit_ / 8;
-            bit_ = bit_ % 8;
-        }
-    }
-
-    mutable unsigned char *byte_;
-    mutable size_t bit_;
+    unsigned char *byte_;
+    size_t bit_;
 };
 
 template <bool is_const> struct bit_iterator_base {
@@ -114,7 +146,7 @@ template <bool is_const> struct bit_iterator_base {
 
     typedef proxy_type *pointer;
     typedef proxy_type &reference;
-    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef std::random_access_iterator_tag iterator_category;
 
     bit_iterator_base() {}
     bit_iterator_base(const bit_iterator_base<false> &b) : value(b.value) {}
@@ -155,26 +187,23 @@ template <bool is_const> struct bit_iterator_base {
         return tmp;
     }
 
-    bit_iterator_base &operator+=(size_t n) {
-        value.increment(n);
+    bit_iterator_base &operator+=(difference_type n) {
+        value.advance(n);
         return *this;
     }
 
-    bit_iterator_base &operator-=(size_t n) {
-        value.decrement(n);
+    bit_iterator_base &operator-=(difference_type n) {
+        value.advance(-n);
         return *this;
     }
 
-    friend bit_iterator_base operator+(bit_iterator_base x, size_t n) {
+    friend bit_iterator_base operator+(bit_iterator_base x, difference_type n) {
         return x += n;
     }
-    friend bit_iterator_base operator+(size_t n, bit_iterator_base x) {
+    friend bit_iterator_base operator+(difference_type n, bit_iterator_base x) {
         return x += n;
     }
-    friend bit_iterator_base operator-(bit_iterator_base x, size_t n) {
-        return x -= n;
-    }
-    friend bit_iterator_base operator-(size_t n, bit_iterator_base x) {
+    friend bit_iterator_base operator-(bit_iterator_base x, difference_type n) {
         return x -= n;
     }
 
@@ -182,7 +211,11 @@ template <bool is_const> struct bit_iterator_base {
         return a.value.difference(b.value);
     }
 
-    bit_proxy operator[](size_t n) const { return *(*this + n); }
+    bit_proxy operator[](difference_type n) const {
+        auto x = value;
+        x.advance(n);
+        return x;
+    }
 
     friend bool operator==(const bit_iterator_base &a,
                            const bit_iterator_base &b) {
@@ -196,7 +229,7 @@ template <bool is_const> struct bit_iterator_base {
 
     friend bool operator<(const bit_iterator_base &a,
                           const bit_iterator_base &b) {
-        return b - a > 0;
+        return a.value.before(b.value);
     }
     friend bool operator>(const bit_iterator_base &a,
                           const bit_iterator_base &b) {
@@ -214,126 +247,331 @@ template <bool is_const> struct bit_iterator_base {
     bit_proxy value;
 };
 
-// this was once a macro
-template <typename A, typename B, typename C, typename D, typename E,
-          typename F>
-inline void prepare_first_copy(A &src_len, B const dst_offset_modulo, C *dst,
-                               D const &reverse_mask, E const &reverse_mask_xor,
-                               F &c) {
-    if (src_len >= static_cast<size_t>(CHAR_BIT - dst_offset_modulo)) {
-        *dst &= reverse_mask[dst_offset_modulo];
-        src_len -= CHAR_BIT - dst_offset_modulo;
-    } else {
-        *dst &= reverse_mask[dst_offset_modulo] |
-                reverse_mask_xor[dst_offset_modulo + src_len];
-        c &= reverse_mask[dst_offset_modulo + src_len];
-        src_len = 0;
-    }
+// Reverse the byte order of a 64 bit word.
+inline uint64_t byte_swap(uint64_t x) {
+#if defined(_MSC_VER)
+    return _byteswap_uint64(x);
+#else
+    return __builtin_bswap64(x);
+#endif
 }
 
-} // namespace detail
+// Population count and bit scans.  These are single instructions where the
+// target has them; x86 only has popcnt when built for it (e.g. -mpopcnt or
+// -march=native), so otherwise the portable SWAR count is used instead of a
+// library call.
+inline int popcount64(uint64_t x) {
+#if defined(__GNUC__) &&                                                       \
+    (defined(__POPCNT__) || !(defined(__x86_64__) || defined(__i386__)))
+    return __builtin_popcountll(x);
+#elif defined(_MSC_VER) && defined(_M_X64) && defined(__AVX__)
+    return static_cast<int>(__popcnt64(x));
+#else
+    x = x - ((x >> 1) & 0x5555555555555555);
+    x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0F;
+    return static_cast<int>((x * 0x0101010101010101) >> 56);
+#endif
+}
 
-template <typename Input, typename Output>
-inline void bit_copy_n(Input first, size_t bit_count, Output result) {
-    typedef unsigned char value_type;
+// Leading zeros of a non zero x.
+inline int clz64(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanReverse64(&i, x);
+    return 63 - static_cast<int>(i);
+#elif defined(_MSC_VER)
+    unsigned long i;
+    if (_BitScanReverse(&i, static_cast<unsigned long>(x >> 32)))
+        return 31 - static_cast<int>(i);
+    _BitScanReverse(&i, static_cast<unsigned long>(x));
+    return 63 - static_cast<int>(i);
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+// Trailing zeros of a non zero x.
+inline int ctz64(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return static_cast<int>(i);
+#elif defined(_MSC_VER)
+    unsigned long i;
+    if (_BitScanForward(&i, static_cast<unsigned long>(x)))
+        return static_cast<int>(i);
+    _BitScanForward(&i, static_cast<unsigned long>(x >> 32));
+    return 32 + static_cast<int>(i);
+#else
+    return __builtin_ctzll(x);
+#endif
+}
 
-    auto src_org = first->get_unsigned_byte();
-    auto dst_org = result->get_unsigned_byte();
+// The full 128 bit product of a and b with its halves xored together, the
+// mixing step of wyhash.
+inline uint64_t mum64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 u128;
+    auto r = static_cast<u128>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t hi;
+    uint64_t lo = _umul128(a, b, &hi);
+    return lo ^ hi;
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = a & 0xFFFFFFFF,
+             lb = b & 0xFFFFFFFF;
+    uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+    uint64_t mid = (ll >> 32) + (hl & 0xFFFFFFFF) + (lh & 0xFFFFFFFF);
+    uint64_t lo = (mid << 32) | (ll & 0xFFFFFFFF);
+    uint64_t hi = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+    return lo ^ hi;
+#endif
+}
 
-    size_t src_offset = first->bit();
-    size_t dst_offset = result->bit();
-    static const unsigned char reverse_mask[] = {0x00, 0x80, 0xc0, 0xe0, 0xf0,
-                                                 0xf8, 0xfc, 0xfe, 0xff};
-    static const unsigned char reverse_mask_xor[] = {
-        0xff, 0x7f, 0x3f, 0x1f, 0x0f, 0x07, 0x03, 0x01, 0x00};
+// Big-endian 64 bit loads and stores that don't care about alignment.
+inline uint64_t load_be64(const unsigned char *p) {
+    uint64_t x;
+    std::memcpy(&x, p, sizeof(x));
+    return system_bigendian() ? x : byte_swap(x);
+}
 
-    if (bit_count) {
-        const value_type *src;
-        value_type *dst;
-        size_t src_offset_modulo, dst_offset_modulo;
+inline void store_be64(unsigned char *p, uint64_t x) {
+    if (!system_bigendian())
+        x = byte_swap(x);
+    std::memcpy(p, &x, sizeof(x));
+}
 
-        src = src_org + (src_offset / CHAR_BIT);
-        dst = dst_org + (dst_offset / CHAR_BIT);
+// Little-endian ones, for formats packed least significant bit first.
+inline uint64_t load_le64(const unsigned char *p) {
+    uint64_t x;
+    std::memcpy(&x, p, sizeof(x));
+    return system_bigendian() ? byte_swap(x) : x;
+}
 
-        src_offset_modulo = src_offset % CHAR_BIT;
-        dst_offset_modulo = dst_offset % CHAR_BIT;
+inline void store_le64(unsigned char *p, uint64_t x) {
+    if (system_bigendian())
+        x = byte_swap(x);
+    std::memcpy(p, &x, sizeof(x));
+}
 
-        if (src_offset_modulo == dst_offset_modulo) {
-            size_t byte_len;
-            size_t src_len_modulo;
-            if (src_offset_modulo) {
-                value_type c;
+// Return n (1 to 8) bits found at bit offset off (0 to 7) of p, left aligned.
+// The second byte is only touched if the bits actually extend into it.
+inline unsigned char fetch_byte(const unsigned char *p, size_t off, size_t n) {
+    unsigned v = static_cast<unsigned>(p[0]) << off;
+    if (off + n > CHAR_BIT)
+        v |= static_cast<unsigned>(p[1]) >> (CHAR_BIT - off);
+    return static_cast<unsigned char>(v & (0xFF00u >> n));
+}
 
-                c = reverse_mask_xor[dst_offset_modulo] & *src++;
+// The copy engine behind bit_copy_n().  The destination is brought to a byte
+// boundary first, then the bulk is moved 64 bits at a time (or with memmove if
+// the source happens to line up too), then the remaining bits are merged in.
+// Bits outside the destination range are preserved, and no byte outside the
+// source range is read.  Overlapping ranges are allowed as long as the
+// destination doesn't start after the source.
+inline void copy_bits(const unsigned char *src, size_t src_bit,
+                      unsigned char *dst, size_t dst_bit, size_t bit_count) {
+    src += src_bit / CHAR_BIT;
+    src_bit %= CHAR_BIT;
+    dst += dst_bit / CHAR_BIT;
+    dst_bit %= CHAR_BIT;
+
+    if (!bit_count)
+        return;
+
+    // Head: fill up the first partial destination byte.
+    if (dst_bit) {
+        size_t n = std::min(bit_count, CHAR_BIT - dst_bit);
+        auto mask = static_cast<unsigned char>((0xFFu >> dst_bit) &
+                                               ~(0xFFu >> (dst_bit + n)));
+        auto c = fetch_byte(src, src_bit, n);
+        *dst = static_cast<unsigned char>((*dst & ~mask) | (c >> dst_bit));
+        src_bit += n;
+        src += src_bit / CHAR_BIT;
+        src_bit %= CHAR_BIT;
+        ++dst;
+        bit_count -= n;
+    }
+
+    // Middle: whole destination bytes.
+    size_t byte_len = bit_count / CHAR_BIT;
+    if (src_bit == 0) {
+        std::memmove(dst, src, byte_len);
+    } else {
+        // Since the source is misaligned, byte i of the destination straddles
+        // source bytes i and i + 1, both of which are inside the range.
+        const size_t rs = CHAR_BIT - src_bit;
+        size_t i = 0;
+        for (; i + 8 <= byte_len; i += 8) {
+            uint64_t w = load_be64(src + i) << src_bit;
+            w |= static_cast<uint64_t>(src[i + 8] >> rs);
+            store_be64(dst + i, w);
+        }
+        for (; i < byte_len; ++i)
+            dst[i] = static_cast<unsigned char>((src[i] << src_bit) |
+                                                (src[i + 1] >> rs));
+    }
+    src += byte_len;
+    dst += byte_len;
 
-                detail::prepare_first_copy(bit_count, dst_offset_modulo, dst,
-                                           reverse_mask, reverse_mask_xor, c);
-                *dst++ |= c;
-            }
+    // Tail: merge in the remaining bits.
+    bit_count %= CHAR_BIT;
+    if (bit_count) {
+        auto mask = static_cast<unsigned char>(~(0xFFu >> bit_count));
+        auto c = fetch_byte(src, src_bit, bit_count);
+        *dst = static_cast<unsigned char>((*dst & ~mask) | c);
+    }
+}
 
-            byte_len = bit_count / CHAR_BIT;
-            src_len_modulo = bit_count % CHAR_BIT;
+// a[i] = op(a[i], b[i]) for n bytes, 64 bits at a time.  Byte order doesn't
+// matter to bitwise operations, so the words are used as they are in memory,
+// and the loops are simple enough for the compiler to vectorize.
+template <typename Op>
+inline void combine_bytes(unsigned char *a, const unsigned char *b, size_t n,
+                          Op op) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        x = op(x, y);
+        std::memcpy(a + i, &x, 8);
+    }
+    for (; i < n; ++i)
+        a[i] = static_cast<unsigned char>(op(a[i], b[i]));
+}
 
-            if (byte_len) {
-                memcpy(dst, src, byte_len);
-                src += byte_len;
-                dst += byte_len;
-            }
-            if (src_len_modulo) {
-                *dst &= reverse_mask_xor[src_len_modulo];
-                *dst |= reverse_mask[src_len_modulo] & *src;
-            }
-        } else {
-            size_t bit_diff_ls, bit_diff_rs;
-            size_t byte_len;
-            size_t src_len_modulo;
-            value_type c;
-            /*
-             * Begin: Line things up on destination.
-             */
-            if (src_offset_modulo > dst_offset_modulo) {
-                bit_diff_ls = src_offset_modulo - dst_offset_modulo;
-                bit_diff_rs = CHAR_BIT - bit_diff_ls;
-
-                // assert(dst_offset_modulo >= 0);
-                c = static_cast<value_type>(*src++ << bit_diff_ls);
-                c |= *src >> bit_diff_rs;
-                c &= reverse_mask_xor[dst_offset_modulo];
-            } else {
-                bit_diff_rs = dst_offset_modulo - src_offset_modulo;
-                bit_diff_ls = CHAR_BIT - bit_diff_rs;
+// Shift n bytes of bits toward the end by bits, filling with zeros.
+inline void shift_toward_end(unsigned char *p, size_t n, size_t bits) {
+    size_t bytes = std::min(bits / CHAR_BIT, n);
+    unsigned r = bits % CHAR_BIT;
+    // Work back from the end so sources are read before they are written.
+    // Destination byte j comes from source bytes j - bytes - 1 and j - bytes.
+    size_t j = n;
+    while (j >= bytes + 8 + 1) {
+        j -= 8;
+        auto w = load_be64(p + j - bytes);
+        if (r)
+            w = (w >> r) |
+                (static_cast<uint64_t>(p[j - bytes - 1]) << (64 - r));
+        store_be64(p + j, w);
+    }
+    while (j > bytes) {
+        --j;
+        unsigned v = p[j - bytes] >> r;
+        if (r && j > bytes)
+            v |= static_cast<unsigned>(p[j - bytes - 1]) << (8 - r);
+        p[j] = static_cast<unsigned char>(v);
+    }
+    std::fill(p, p + bytes, 0);
+}
 
-                c = *src >> bit_diff_rs & reverse_mask_xor[dst_offset_modulo];
-            }
-            detail::prepare_first_copy(bit_count, dst_offset_modulo, dst,
-                                       reverse_mask, reverse_mask_xor, c);
-            *dst++ |= c;
-
-            /*
-             * Middle: copy with only shifting the source.
-             */
-            byte_len = bit_count / CHAR_BIT;
-            for (size_t i = 0; i < byte_len; ++i) {
-                c = static_cast<value_type>(*src++ << bit_diff_ls);
-                c |= *src >> bit_diff_rs;
-                *dst++ = c;
-            }
-            byte_len = 0;
-
-            /*
-             * End: copy the remaing bits;
-             */
-            src_len_modulo = bit_count % CHAR_BIT;
-            if (src_len_modulo) {
-                c = static_cast<value_type>(*src++ << bit_diff_ls);
-                c |= *src >> bit_diff_rs;
-                c &= reverse_mask[src_len_modulo];
-
-                *dst &= reverse_mask_xor[src_len_modulo];
-                *dst |= c;
-            }
-        }
+// Load n (0 to 8) bytes into the most significant end of a big-endian word.
+inline uint64_t load_be(const unsigned char *p, size_t n) {
+    if (n == 8)
+        return load_be64(p);
+    uint64_t x = 0;
+    for (size_t i = 0; i < n; ++i)
+        x |= static_cast<uint64_t>(p[i]) << (56 - 8 * i);
+    return x;
+}
+
+// Return the n (0 to 64) bits found at bit offset bit of p, right aligned.
+// Only the bytes holding those bits are read.
+inline uint64_t read_bits(const unsigned char *p, size_t bit, size_t n) {
+    if (!n)
+        return 0;
+    p += bit / CHAR_BIT;
+    bit %= CHAR_BIT;
+    size_t bytes = (bit + n + 7) / CHAR_BIT;
+    uint64_t x;
+    if (bytes <= 8)
+        x = load_be(p, bytes) << bit;
+    else
+        x = (load_be64(p) << bit) | (p[8] >> (CHAR_BIT - bit));
+    return x >> (64 - n);
+}
+
+// Compare n bits at two arbitrary bit addresses.
+inline bool equal_bits(const unsigned char *a, size_t a_bit,
+                       const unsigned char *b, size_t b_bit, size_t n) {
+    a += a_bit / CHAR_BIT;
+    a_bit %= CHAR_BIT;
+    b += b_bit / CHAR_BIT;
+    b_bit %= CHAR_BIT;
+    if (a_bit == 0 && b_bit == 0) {
+        size_t bytes = n / CHAR_BIT;
+        if (bytes && std::memcmp(a, b, bytes))
+            return false;
+        n %= CHAR_BIT;
+        return !n || ((a[bytes] ^ b[bytes]) & (0xFF00u >> n) & 0xFF) == 0;
     }
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+        if (read_bits(a, a_bit + i, 64) != read_bits(b, b_bit + i, 64))
+            return false;
+    return read_bits(a, a_bit + i, n - i) == read_bits(b, b_bit + i, n - i);
+}
+
+// Number of set bits among the first n bits of p.
+inline size_t count_bits(const unsigned char *p, size_t n) {
+    size_t bytes = n / CHAR_BIT;
+    size_t c = 0;
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        c += popcount64(w);
+    }
+    for (; i < bytes; ++i)
+        c += popcount64(p[i]);
+    if (n % CHAR_BIT)
+        c += popcount64(p[bytes] & (0xFF00u >> (n % CHAR_BIT)) & 0xFF);
+    return c;
+}
+
+// Index of the first set bit in [pos, n) of p, or n if there is none.
+inline size_t find_set(const unsigned char *p, size_t pos, size_t n) {
+    if (pos >= n)
+        return n;
+    size_t bytes = (n + 7) / CHAR_BIT;
+    size_t b = pos / CHAR_BIT;
+    auto w = load_be(p + b, std::min<size_t>(8, bytes - b)) &
+             (~uint64_t(0) >> (pos % CHAR_BIT));
+    while (!w) {
+        b += 8;
+        if (b >= bytes)
+            return n;
+        w = load_be(p + b, std::min<size_t>(8, bytes - b));
+    }
+    return std::min(n, b * CHAR_BIT + clz64(w));
+}
+
+// Index of the last set bit in the first n bits of p, or n if there is none.
+inline size_t find_last_set(const unsigned char *p, size_t n) {
+    size_t bytes = (n + 7) / CHAR_BIT;
+    size_t end = bytes;
+    while (end) {
+        size_t start = end >= 8 ? end - 8 : 0;
+        auto w = load_be(p + start, end - start);
+        size_t used = n - start * CHAR_BIT; // bits of this word inside n
+        if (used < 64)
+            w &= ~(~uint64_t(0) >> used);
+        if (w)
+            return start * CHAR_BIT + 63 - ctz64(w);
+        end = start;
+    }
+    return n;
+}
+
+} // namespace detail
+
+template <typename Input, typename Output>
+inline void bit_copy_n(Input first, size_t bit_count, Output result) {
+    detail::copy_bits(first->get_unsigned_byte(), first->bit(),
+                      result->get_unsigned_byte(), result->bit(), bit_count);
 }
 
 // no return iterator for performance reasons
@@ -345,6 +583,90 @@ inline void bit_copy(Input first, Input last, Output result) {
 typedef detail::bit_iterator_base<false> bit_iterator;
 typedef detail::bit_iterator_base<true> const_bit_iterator;
 
+#ifdef ICT_HAS_PMR
+typedef std::pmr::memory_resource memory_resource;
+#else
+// Minimal stand in for std::pmr::memory_resource on libraries without it.
+class memory_resource {
+  public:
+    virtual ~memory_resource() = default;
+    void *allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+        return do_allocate(bytes, align);
+    }
+    void deallocate(void *p, size_t bytes,
+                    size_t align = alignof(std::max_align_t)) {
+        do_deallocate(p, bytes, align);
+    }
+
+  private:
+    virtual void *do_allocate(size_t bytes, size_t align) = 0;
+    virtual void do_deallocate(void *p, size_t bytes, size_t align) = 0;
+};
+#endif
+
+namespace detail {
+// Heap storage is prefixed with a header recording where it came from, so a
+// bitstring can be moved or destroyed without knowing its resource.
+struct heap_header {
+    memory_resource *resource; // nullptr for global operator new
+    size_t capacity;           // bytes following the header
+};
+
+inline memory_resource *&thread_resource() {
+    static thread_local memory_resource *r = nullptr;
+    return r;
+}
+
+inline unsigned char *heap_alloc(size_t bytes, memory_resource *r) {
+    const size_t total = sizeof(heap_header) + bytes;
+    void *p = r ? r->allocate(total, alignof(heap_header))
+                : ::operator new(total);
+    auto h = new (p) heap_header{r, bytes};
+    return reinterpret_cast<unsigned char *>(h + 1);
+}
+
+inline heap_header *header_of(unsigned char *p) {
+    return reinterpret_cast<heap_header *>(p) - 1;
+}
+
+inline void heap_free(unsigned char *p) {
+    auto h = header_of(p);
+    if (h->resource)
+        h->resource->deallocate(h, sizeof(heap_header) + h->capacity,
+                                alignof(heap_header));
+    else
+        ::operator delete(h);
+}
+} // namespace detail
+
+// The resource used for bitstring allocations on this thread, nullptr means
+// global operator new.
+inline memory_resource *bitstring_resource() {
+    return detail::thread_resource();
+}
+
+// Allocate bitstrings created on this thread from r until the scope ends.
+// Everything allocated from r must be destroyed before r is.
+//
+//     std::pmr::monotonic_buffer_resource arena(buf, sizeof(buf));
+//     ict::bitstring_resource_scope scope(&arena);
+//     auto fields = decode(message); // every field comes from the arena
+struct bitstring_resource_scope {
+    explicit bitstring_resource_scope(memory_resource *r)
+        : prev_(detail::thread_resource()) {
+        detail::thread_resource() = r;
+    }
+    ~bitstring_resource_scope() { detail::thread_resource() = prev_; }
+    bitstring_resource_scope(const bitstring_resource_scope &) = delete;
+    bitstring_resource_scope &
+    operator=(const bitstring_resource_scope &) = delete;
+
+  private:
+    memory_resource *prev_;
+};
+
+struct bitstring_view;
+
 struct bitstring {
     typedef unsigned char *pointer;
     typedef const char *const_pointer;
@@ -352,55 +674,48 @@ struct bitstring {
     typedef const unsigned char *const_iterator;
 
     // Regular
-    bitstring() : buffer_(nullptr), begin_(nullptr) { set_size(0); }
+    // number of bits stored inline
+    static constexpr size_t local_bits = ICT_BITSTRING_LOCAL_BYTES * 8;
+
+    bitstring() : local_() {}
 
-    bitstring(size_t bit_size) {
-        alloc(bit_size);
+    bitstring(size_t bit_size) : bitstring(bit_size, bitstring_resource()) {}
+
+    // Allocate from r rather than the thread's bitstring_resource().
+    bitstring(size_t bit_size, memory_resource *r) {
+        alloc(bit_size, r);
         std::fill(begin(), end(), 0);
     }
 
-    bitstring(const bitstring &a) : bitstring(a.bit_size()) {
+    bitstring(const bitstring &a) : bitstring(a, bitstring_resource()) {}
+
+    bitstring(const bitstring &a, memory_resource *r)
+        : bitstring(a.bit_size(), r) {
         std::copy(a.begin(), a.end(), begin());
     }
 
-    template <typename Input> bitstring(Input first, Input last) {
-        alloc(last - first);
-        bit_copy(first, last, bit_begin());
-    }
+    template <typename Input>
+    bitstring(Input first, Input last)
+        : bitstring(first, static_cast<size_t>(last - first)) {}
 
     template <typename Input> bitstring(Input first, size_t len) {
         alloc(len);
-        bit_copy(first, first + len, bit_begin());
-    }
-
-    bitstring(bitstring &&a) noexcept {
-        bit_size_ = a.bit_size_;
-        buffer_ = a.buffer_;
-        if (local())
-            begin_ = reinterpret_cast<pointer>(&buffer_);
+        // Pick the storage by len rather than through begin(), so GCC sees
+        // the bound on local_ and doesn't warn of copies past it.
+        if (len <= local_bits)
+            bit_copy_n(first, len, bit_iterator(local_, 0));
         else
-            begin_ = buffer_;
-        a.bit_size_ = 0;
+            bit_copy_n(first, len, bit_iterator(buffer_, 0));
     }
 
-    bitstring(int base, const char *str);
-
-    bitstring(const std::string &str) {
-        std::string s(str);
-        ict::squash(s);
-
-        size_t len = s.size();
+    bitstring(bitstring &&a) noexcept { steal(a); }
 
-        if ((len >= 3) && (s[0] == '#')) {
-            *this = bitstring(16, s.c_str() + 1);
-        } else if ((len >= 2) && (s[0] == '@')) {
-            *this = bitstring(2, s.c_str() + 1);
-        } else {
-            *this = bitstring(16, s.c_str());
-        }
-    }
+    bitstring(int base, const char *str);
 
-    bitstring(const char *str) : bitstring(std::string(str)) {}
+    // Parse "#hex", "@binary" or plain hex, ignoring whitespace.  Invalid
+    // text gives an empty bitstring, see parse_bitstring() for the details.
+    inline bitstring(const std::string &str);
+    inline bitstring(const char *str);
 
     bitstring substr(size_t index,
                      size_t len = std::numeric_limits<size_t>::max()) const {
@@ -417,43 +732,194 @@ struct bitstring {
 
     ~bitstring() { clear(); }
 
+    // Reuses the existing storage if it is big enough.
     bitstring &operator=(const bitstring &b) {
         if (this != &b) {
-            resize(b.bit_size());
+            if (b.bit_size() > capacity()) {
+                clear();
+                alloc(b.bit_size());
+            } else {
+                set_size(b.bit_size());
+            }
             std::copy(b.begin(), b.end(), begin());
         }
         return *this;
     }
 
     bitstring &operator=(bitstring &&b) noexcept {
-        if (!local())
-            delete[] buffer_;
-        bit_size_ = b.bit_size_;
-        buffer_ = b.buffer_;
-        if (local())
-            begin_ = reinterpret_cast<pointer>(&buffer_);
-        else
-            begin_ = buffer_;
-
-        b.bit_size_ = 0;
+        if (this != &b) {
+            clear();
+            steal(b);
+        }
         return *this;
     }
 
+    // Resize to s bits.  New bits are 0.  Growing past capacity() at least
+    // doubles it, shrinking never gives storage back (see shrink_to_fit()).
     void resize(size_t s) {
-        if (s > bit_size_) {
-            auto bs = bitstring(s);
-            std::copy(begin(), end(), bs.begin());
-            *this = std::move(bs);
+        auto old = bit_size();
+        grow(s);
+        set_size(s);
+        if (s > old) {
+            size_t first = (old + 7) / 8;
+            if (old % 8)
+                begin()[old / 8] &=
+                    static_cast<unsigned char>(~(0xFFu >> (old % 8)));
+            std::fill(begin() + first, end(), 0);
         } else {
-            bit_size_ = s;
+            clear_tail();
         }
     }
 
+    // Make room for at least bits without reallocating.
+    void reserve(size_t bits) {
+        if (bits > capacity())
+            reallocate(bits);
+    }
+
+    // Number of bits that fit in the current storage.
+    size_t capacity() const {
+        return local() ? local_bits : detail::header_of(buffer_)->capacity * 8;
+    }
+
+    // Release unused capacity, moving the bits inline if they fit.
+    void shrink_to_fit() {
+        if (!local() && (bit_size() <= local_bits ||
+                         detail::header_of(buffer_)->capacity > byte_size()))
+            reallocate(bit_size());
+    }
+
+    // Append one bit, amortized O(1).
+    void push_back(bool v) {
+        auto n = bit_size();
+        grow(n + 1);
+        set_size(n + 1);
+        if (n % 8 == 0)
+            begin()[n / 8] = 0;
+        set_bit(begin(), n, v);
+    }
+
+    // Append len bits starting at first, which must not point into this
+    // bitstring.
+    bitstring &append(const_bit_iterator first, size_t len) {
+        auto n = bit_size();
+        grow(n + len);
+        set_size(n + len);
+        bit_copy_n(first, len, bit_begin() + n);
+        clear_tail();
+        return *this;
+    }
+
+    // Append b, which may be *this.
+    bitstring &append(const bitstring &b) {
+        auto n = bit_size();
+        auto len = b.bit_size();
+        grow(n + len);
+        set_size(n + len);
+        bit_copy_n(b.bit_begin(), len, bit_begin() + n);
+        clear_tail();
+        return *this;
+    }
+
+    // Returned by the find functions when there is no such bit.
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    // Bit queries, a word at a time.
+    size_t count() const { return detail::count_bits(begin(), bit_size()); }
+    bool any() const { return find_first() != npos; }
+    bool none() const { return !any(); }
+
+    // Index of the first set bit, or npos.
+    size_t find_first() const { return find_from(0); }
+
+    // Index of the first set bit after pos, or npos.  Walk the set bits with
+    //     for (auto i = b.find_first(); i != b.npos; i = b.find_next(i))
+    size_t find_next(size_t pos) const {
+        return pos >= bit_size() ? npos : find_from(pos + 1);
+    }
+
+    // Index of the last set bit, or npos.
+    size_t find_last() const {
+        auto i = detail::find_last_set(begin(), bit_size());
+        return i == bit_size() ? npos : i;
+    }
+
+    // Pattern search at any bit offset, see bitstring_view::find().
+    inline size_t find(const bitstring_view &pattern, size_t start = 0) const;
+    inline std::vector<size_t> find_all(const bitstring_view &pattern) const;
+    inline std::vector<size_t> find_all(const bitstring_view &pattern,
+                                        size_t max_errors) const;
+
+    // Bitwise operations work on whole words.  Both sides must be the same
+    // size.
+    bitstring &operator&=(const bitstring &b) {
+        check_same_size(b);
+        detail::combine_bytes(begin(), b.begin(), byte_size(),
+                              [](auto x, auto y) { return x & y; });
+        clear_tail();
+        return *this;
+    }
+
+    bitstring &operator|=(const bitstring &b) {
+        check_same_size(b);
+        detail::combine_bytes(begin(), b.begin(), byte_size(),
+                              [](auto x, auto y) { return x | y; });
+        clear_tail();
+        return *this;
+    }
+
+    bitstring &operator^=(const bitstring &b) {
+        check_same_size(b);
+        detail::combine_bytes(begin(), b.begin(), byte_size(),
+                              [](auto x, auto y) { return x ^ y; });
+        clear_tail();
+        return *this;
+    }
+
+    // Flip every bit.
+    bitstring &flip() {
+        detail::combine_bytes(begin(), begin(), byte_size(),
+                              [](auto x, auto) { return ~x; });
+        clear_tail();
+        return *this;
+    }
+
+    // Shift toward index 0 (like shifting a big-endian number left), filling
+    // with zeros.  The size doesn't change.
+    bitstring &operator<<=(size_t n) {
+        auto size = bit_size();
+        n = std::min(n, size);
+        detail::copy_bits(begin(), n, begin(), 0, size - n);
+        set_size(size - n);
+        resize(size); // zeroes the vacated bits
+        return *this;
+    }
+
+    // Shift toward the end, filling with zeros.  The size doesn't change.
+    bitstring &operator>>=(size_t n) {
+        detail::shift_toward_end(begin(), byte_size(), n);
+        clear_tail();
+        return *this;
+    }
+
+    friend bitstring operator&(bitstring a, const bitstring &b) {
+        return a &= b;
+    }
+    friend bitstring operator|(bitstring a, const bitstring &b) {
+        return a |= b;
+    }
+    friend bitstring operator^(bitstring a, const bitstring &b) {
+        return a ^= b;
+    }
+    friend bitstring operator~(bitstring a) { return a.flip(); }
+    friend bitstring operator<<(bitstring a, size_t n) { return a <<= n; }
+    friend bitstring operator>>(bitstring a, size_t n) { return a >>= n; }
+
     friend bool operator==(const bitstring &a, const bitstring &b) {
         // possible they are equal all but for the size (e.g., @100 and @1000)
         if (a.bit_size() != b.bit_size())
             return false;
-        return std::equal(a.begin(), a.end(), b.begin());
+        return detail::equal_bits(a.begin(), 0, b.begin(), 0, a.bit_size());
     }
 
     friend bool operator!=(const bitstring &a, const bitstring &b) {
@@ -462,12 +928,12 @@ struct bitstring {
 
     bool empty() const { return bit_size() == 0; }
 
-    iterator begin() { return begin_; }
-    const_iterator begin() const { return begin_; }
-    iterator end() { return begin_ + byte_size(); }
-    const_iterator end() const { return begin_ + byte_size(); }
+    iterator begin() { return storage(); }
+    const_iterator begin() const { return storage(); }
+    iterator end() { return storage() + byte_size(); }
+    const_iterator end() const { return storage() + byte_size(); }
 
-    char *data() const { return reinterpret_cast<char *>(begin_); }
+    char *data() const { return reinterpret_cast<char *>(storage()); }
 
     bit_iterator bit_begin() { return bit_iterator(data(), 0); }
     const_bit_iterator bit_begin() const {
@@ -478,11 +944,17 @@ struct bitstring {
         return const_bit_iterator(data(), bit_size());
     }
 
-    size_t byte_size() const { return ((bit_size_ % 8) != 0) + bit_size_ / 8; }
+    size_t byte_size() const { return (bit_size() + 7) / 8; }
 
-    size_t bit_size() const { return bit_size_; }
+    size_t bit_size() const { return bit_size_ & ~heap_flag; }
+
+    bool local() const { return !(bit_size_ & heap_flag); }
 
-    bool local() const { return bit_size() <= (sizeof(pointer) * 8); }
+    // The resource the bits were allocated from, nullptr if they are stored
+    // inline or came from global operator new.
+    memory_resource *resource() const {
+        return local() ? nullptr : detail::header_of(buffer_)->resource;
+    }
 
     void set(size_t index) {
         set_bit(reinterpret_cast<unsigned char *>(data()), index, 1);
@@ -496,30 +968,99 @@ struct bitstring {
 
     void clear() {
         if (!local())
-            delete[] buffer_;
-        set_size(0);
-        buffer_ = nullptr;
-        begin_ = nullptr;
+            detail::heap_free(buffer_);
+        bit_size_ = 0;
     }
 
   private:
-    void alloc(size_t s) {
-        set_size(s);
-        if (local()) {
-            begin_ = reinterpret_cast<pointer>(&buffer_);
+    // obitstream writes past bit_size() into spare capacity
+    friend struct obitstream;
+
+    static_assert(ICT_BITSTRING_LOCAL_BYTES >= sizeof(pointer),
+                  "ICT_BITSTRING_LOCAL_BYTES is smaller than a pointer");
+
+    // set in bit_size_ when the bits are on the heap
+    static constexpr size_t heap_flag = ~(~size_t(0) >> 1);
+
+    void alloc(size_t s, memory_resource *r = bitstring_resource()) {
+        if (s <= local_bits) {
+            // two or three stores, and the whole inline buffer is defined
+            std::memset(local_, 0, sizeof(local_));
+            bit_size_ = s;
         } else {
-            buffer_ = new unsigned char[byte_size()];
-            begin_ = buffer_;
+            buffer_ = detail::heap_alloc((s + 7) / 8, r);
+            bit_size_ = s | heap_flag;
+            // zero the last byte so byte compares will work
+            buffer_[byte_size() - 1] = 0;
         }
-        data()[byte_size() - 1] =
-            0; // zero the last byte so byte compares will work
     }
 
-    void set_size(size_t bit_size) { bit_size_ = bit_size; }
+    // Move the bits to storage for exactly bits (>= bit_size()), inline if
+    // they fit.  Heap storage stays with its resource.
+    void reallocate(size_t bits) {
+        auto n = byte_size();
+        if (bits <= local_bits) {
+            auto p = buffer_;
+            std::memcpy(local_, p, n);
+            detail::heap_free(p);
+            bit_size_ &= ~heap_flag;
+        } else {
+            auto r = local() ? bitstring_resource() : resource();
+            auto p = detail::heap_alloc((bits + 7) / 8, r);
+            if (n)
+                std::memcpy(p, begin(), n);
+            if (!local())
+                detail::heap_free(buffer_);
+            buffer_ = p;
+            bit_size_ |= heap_flag;
+        }
+    }
+
+    // Make sure there is room for bits, at least doubling the capacity.
+    void grow(size_t bits) {
+        if (bits > capacity())
+            reallocate(std::max(bits, 2 * capacity()));
+    }
+
+    // Zero the unused bits of the last byte.
+    void clear_tail() {
+        if (bit_size() % 8)
+            begin()[bit_size() / 8] &=
+                static_cast<unsigned char>(~(0xFFu >> (bit_size() % 8)));
+    }
+
+    void steal(bitstring &a) {
+        bit_size_ = a.bit_size_;
+        std::memcpy(local_, a.local_, sizeof(local_)); // or the pointer
+        a.bit_size_ = 0;
+    }
+
+    pointer storage() const {
+        return local() ? const_cast<pointer>(local_) : buffer_;
+    }
+
+    void set_size(size_t bit_size) {
+        bit_size_ = (bit_size_ & heap_flag) | bit_size;
+    }
+
+    size_t find_from(size_t pos) const {
+        auto i = detail::find_set(begin(), pos, bit_size());
+        return i == bit_size() ? npos : i;
+    }
+
+    void check_same_size(const bitstring &b) const {
+        if (bit_size() != b.bit_size())
+            IT_PANIC("bitstring sizes differ: " << bit_size() << " and "
+                                                << b.bit_size());
+    }
 
+    // Inline bits share space with the heap pointer, so the default
+    // configuration is three words.
     size_t bit_size_ = 0;
-    pointer buffer_ = nullptr;
-    pointer begin_ = nullptr;
+    union {
+        unsigned char local_[ICT_BITSTRING_LOCAL_BYTES];
+        pointer buffer_;
+    };
 };
 
 inline std::string to_string(const bitstring &bits) {
@@ -544,57 +1085,718 @@ inline std::ostream &operator<<(std::ostream &os, const bitstring &bits) {
     return os;
 }
 
-struct ibitstream {
-    ibitstream() = delete;
-
-    ibitstream(const ibitstream &) = delete;
-
-    ibitstream(const bitstring &bits_)
-        : bits(bits_), bit_index(bits_.bit_begin()) {
-        // index = 0;
-        end_bit_list.push_back(bits.bit_end());
-        mark();
+namespace detail {
+// Finds a pattern at any bit offset.  A pattern of 16 bits or more has a whole
+// byte at a known place for each of the 8 ways it can sit across byte
+// boundaries, so the haystack is filtered for those 8 byte values (16 bytes at
+// a time with SSE2, on byte pairs once the pattern has 24 bits) and only the
+// hits are compared.  Shorter patterns are compared at every offset out of a
+// 64 bit window.
+class bit_searcher {
+  public:
+    bit_searcher(const unsigned char *pat, size_t pat_bit, size_t m)
+        : pat_(pat), pat_bit_(pat_bit), m_(m), shifts_() {
+        prefix_bits_ = std::min<size_t>(m, 64);
+        prefix_ = read_bits(pat, pat_bit, prefix_bits_);
+        if (m < 16)
+            return;
+        for (unsigned s = 0; s < 8; ++s) {
+            // with the pattern starting at bit s of a byte, the next byte
+            // boundary is (8 - s) % 8 bits into the pattern
+            auto key = static_cast<unsigned char>(
+                read_bits(pat, pat_bit + (8 - s) % 8, 8));
+            if (!shifts_[key])
+                keys_[key_count_++] = key;
+            shifts_[key] |= static_cast<unsigned char>(1 << s);
+            shift_keys_[s] = key;
+            if (m >= 24)
+                next_keys_[s] = static_cast<unsigned char>(
+                    read_bits(pat, pat_bit + (8 - s) % 8 + 8, 8));
+        }
     }
 
-    void advance() {
-        // ++index;
-        ++bit_index;
-    }
-    void advance(size_t n) {
-        // index += n;
-        bit_index += n;
+    // The first match starting in [from, n - m], with bit 0 being the first
+    // bit of p, or n if there is none.
+    size_t find(const unsigned char *p, size_t from, size_t n) const {
+        if (m_ > n || from > n - m_)
+            return n;
+        if (!m_)
+            return from;
+        const size_t last = n - m_; // the last place a match can start
+        if (m_ < 16)
+            return find_short(p, from, last, n);
+
+        // A match at c = j * 8 has its key at byte j, one at c = (j - 1) * 8 + s
+        // has it at byte j.  The last key byte is inside the haystack since
+        // the pattern covers at least one byte after it.
+        const size_t bytes = (n + 7) / 8;
+        size_t j = from / 8;
+        const size_t j_last = last / 8 + 1;
+#ifdef ICT_HAS_SSE2
+        if (m_ >= 24) {
+            // filter on the two whole bytes each shift puts at j and j + 1
+            __m128i first[8], second[8];
+            for (unsigned s = 0; s < 8; ++s) {
+                first[s] = _mm_set1_epi8(static_cast<char>(shift_keys_[s]));
+                second[s] = _mm_set1_epi8(static_cast<char>(next_keys_[s]));
+            }
+            for (; j + 16 <= j_last; j += 16) {
+                auto v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(p + j));
+                auto w = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(p + j + 1));
+                auto hits = _mm_and_si128(_mm_cmpeq_epi8(v, first[0]),
+                                          _mm_cmpeq_epi8(w, second[0]));
+                for (unsigned s = 1; s < 8; ++s)
+                    hits = _mm_or_si128(
+                        hits, _mm_and_si128(_mm_cmpeq_epi8(v, first[s]),
+                                            _mm_cmpeq_epi8(w, second[s])));
+                for (unsigned m = static_cast<unsigned>(_mm_movemask_epi8(hits));
+                     m; m &= m - 1) {
+                    auto c = check(p, j + static_cast<size_t>(ctz64(m)),
+                                   from, last, bytes);
+                    if (c <= last)
+                        return c;
+                }
+            }
+        }
+        __m128i keys[8];
+        for (size_t k = 0; k < key_count_; ++k)
+            keys[k] = _mm_set1_epi8(static_cast<char>(keys_[k]));
+        for (; j + 16 <= j_last + 1; j += 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + j));
+            auto hits = _mm_cmpeq_epi8(v, keys[0]);
+            for (size_t k = 1; k < key_count_; ++k)
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, keys[k]));
+            for (unsigned m = static_cast<unsigned>(_mm_movemask_epi8(hits)); m;
+                 m &= m - 1) {
+                auto c = check(p, j + static_cast<size_t>(ctz64(m)), from,
+                               last, bytes);
+                if (c <= last)
+                    return c;
+            }
+        }
+#endif
+        for (; j <= j_last; ++j) {
+            if (shifts_[p[j]]) {
+                auto c = check(p, j, from, last, bytes);
+                if (c <= last)
+                    return c;
+            }
+        }
+        return n;
     }
 
-    // read up to n bits blindly
-    bitstring read_blind(size_t n) {
-        auto f = bit_index;
-        advance(n);
-        return bitstring(f, n);
-    }
+  private:
+    // Compare at bit c of a haystack of the given number of bytes.
+    bool matches(const unsigned char *p, size_t c, size_t bytes) const {
+        uint64_t x;
+        if (c / 8 + 9 <= bytes) {
+            auto q = p + c / 8;
+            unsigned s = c % 8;
+            x = load_be64(q) << s;
+            if (s)
+                x |= q[8] >> (8 - s);
+            x >>= 64 - prefix_bits_;
+        } else {
+            x = read_bits(p, c, prefix_bits_);
+        }
+        return x == prefix_ &&
+               (m_ <= 64 ||
+                equal_bits(p, c + 64, pat_, pat_bit_ + 64, m_ - 64));
+    }
+
+    // Verify the matches key byte j could start, lowest first.  Returns a
+    // value past last if there are none.
+    size_t check(const unsigned char *p, size_t j, size_t from, size_t last,
+                 size_t bytes) const {
+        unsigned mask = shifts_[p[j]];
+        for (unsigned b = j ? mask & 0xFE : 0; b; b &= b - 1) {
+            size_t c = (j - 1) * 8 + static_cast<size_t>(ctz64(b));
+            if (c >= from && c <= last && matches(p, c, bytes))
+                return c;
+        }
+        size_t c = j * 8;
+        if ((mask & 1) && c >= from && c <= last && matches(p, c, bytes))
+            return c;
+        return last + 1;
+    }
+
+    size_t find_short(const unsigned char *p, size_t from, size_t last,
+                      size_t n) const {
+        const size_t bytes = (n + 7) / 8;
+        for (size_t j = from / 8; j * 8 <= last; ++j) {
+            auto w = load_be(p + j, std::min<size_t>(8, bytes - j));
+            for (unsigned s = 0; s < 8; ++s) {
+                size_t c = j * 8 + s;
+                if (c > last)
+                    return n;
+                if (c >= from && ((w << s) >> (64 - m_)) == prefix_)
+                    return c;
+            }
+        }
+        return n;
+    }
+
+    const unsigned char *pat_;
+    size_t pat_bit_;
+    size_t m_;
+    uint64_t prefix_;
+    size_t prefix_bits_;
+    unsigned char keys_[8] = {};
+    unsigned char shift_keys_[8] = {}; // the key byte for each shift
+    unsigned char next_keys_[8] = {};  // and the one after it
+    size_t key_count_ = 0;
+    unsigned char shifts_[256]; // shifts each key byte stands for
+};
 
-    // read up to n bits
-    bitstring read(size_t n) {
-        if (n > remaining())
-            n = remaining();
-        return read_blind(n);
-    }
+// The 64 bits at bit offset bit of p, with zeros for any past bit n.
+inline uint64_t window64(const unsigned char *p, size_t bit, size_t n) {
+    if (bit >= n)
+        return 0;
+    auto len = std::min<size_t>(64, n - bit);
+    return read_bits(p, bit, len) << (64 - len);
+}
 
-    // TODO untested read_to for Dave's protocol
-    bitstring read_to(char ch) {
-        auto first = bit_index->get_byte();
-        auto last = first;
-        while (*last != ch)
-            ++last;
-        ++last;
-        return read_blind(last - first);
+// Append to found every c in [from, last] where the m (1 to 64) bits at bit
+// c of p, a buffer of n bits, differ from pattern (right aligned) in at most
+// k places.
+//
+// Rather than a popcount per offset, 64 consecutive offsets are scored at
+// once: bit i of the XOR of the text shifted by b with pattern bit b says
+// whether offset c + i has an error at b, and those words are summed into
+// Levels bit sliced counters.  The counters start at 2^Levels - (k + 1) so a
+// carry out of the top one marks an offset with more than k errors, and a
+// block is abandoned as soon as every offset in it has one.
+template <size_t Levels>
+void find_near(const unsigned char *p, size_t from, size_t last, size_t n,
+               uint64_t pattern, size_t m, size_t k,
+               std::vector<size_t> &found) {
+    const uint64_t start = (uint64_t(1) << Levels) - (k + 1);
+    size_t c = from;
+#ifdef ICT_HAS_SSE2
+    // two blocks side by side, offsets c to c + 63 in the low lane
+    const __m128i ones = _mm_set1_epi32(-1);
+    for (; c <= last && last - c >= 127; c += 128) {
+        __m128i counter[Levels ? Levels : 1];
+        for (size_t i = 0; i < Levels; ++i)
+            counter[i] = (start >> i) & 1 ? ones : _mm_setzero_si128();
+        __m128i over = _mm_setzero_si128();
+        const uint64_t w[3] = {window64(p, c, n), window64(p, c + 64, n),
+                               window64(p, c + 128, n)};
+        const __m128i w0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(w));
+        const __m128i w1 =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(w + 1));
+        for (size_t b = 0; b < m; ++b) {
+            // a shift count of 64 gives zero
+            __m128i text = _mm_or_si128(
+                _mm_sll_epi64(w0, _mm_cvtsi32_si128(static_cast<int>(b))),
+                _mm_srl_epi64(w1, _mm_cvtsi32_si128(static_cast<int>(64 - b))));
+            __m128i carry = _mm_xor_si128(
+                text, _mm_set1_epi32(-static_cast<int>(
+                          (pattern >> (m - 1 - b)) & 1)));
+            for (size_t i = 0; i < Levels; ++i) {
+                __m128i t = _mm_and_si128(counter[i], carry);
+                counter[i] = _mm_xor_si128(counter[i], carry);
+                carry = t;
+            }
+            over = _mm_or_si128(over, carry);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(over, ones)) == 0xFFFF)
+                break;
+        }
+        uint64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), over);
+        for (size_t h = 0; h < 2; ++h) {
+            for (uint64_t hits = ~lanes[h]; hits;) {
+                auto i = clz64(hits);
+                found.push_back(c + 64 * h + static_cast<size_t>(i));
+                hits &= ~(uint64_t(1) << (63 - i));
+            }
+        }
+    }
+#endif
+    for (; c <= last; c += 64) {
+        uint64_t counter[Levels ? Levels : 1];
+        for (size_t i = 0; i < Levels; ++i)
+            counter[i] = 0 - ((start >> i) & 1);
+        uint64_t over = 0;
+        const uint64_t w0 = window64(p, c, n);
+        const uint64_t w1 = window64(p, c + 64, n);
+        for (size_t b = 0; b < m && ~over; ++b) {
+            uint64_t text = b ? (w0 << b) | (w1 >> (64 - b)) : w0;
+            uint64_t carry = text ^ (0 - ((pattern >> (m - 1 - b)) & 1));
+            for (size_t i = 0; i < Levels; ++i) {
+                uint64_t t = counter[i] & carry;
+                counter[i] ^= carry;
+                carry = t;
+            }
+            over |= carry;
+        }
+        // bit 63 is offset c
+        uint64_t hits = ~over;
+        if (last - c < 63)
+            hits &= ~uint64_t(0) << (63 - (last - c));
+        while (hits) {
+            auto i = clz64(hits);
+            found.push_back(c + static_cast<size_t>(i));
+            hits &= ~(uint64_t(1) << (63 - i));
+        }
+        if (last - c < 64)
+            break;
+    }
+}
+
+inline void find_near(const unsigned char *p, size_t from, size_t n,
+                      uint64_t pattern, size_t m, size_t k,
+                      std::vector<size_t> &found) {
+    if (m > n || from > n - m)
+        return;
+    const size_t last = n - m;
+    if (k >= m) {
+        for (size_t c = from; c <= last; ++c)
+            found.push_back(c);
+        return;
+    }
+    // counters wide enough to count to k, which is below 64
+    if (k == 0)
+        find_near<0>(p, from, last, n, pattern, m, k, found);
+    else if (k < 2)
+        find_near<1>(p, from, last, n, pattern, m, k, found);
+    else if (k < 4)
+        find_near<2>(p, from, last, n, pattern, m, k, found);
+    else if (k < 8)
+        find_near<3>(p, from, last, n, pattern, m, k, found);
+    else if (k < 16)
+        find_near<4>(p, from, last, n, pattern, m, k, found);
+    else if (k < 32)
+        find_near<5>(p, from, last, n, pattern, m, k, found);
+    else
+        find_near<6>(p, from, last, n, pattern, m, k, found);
+}
+} // namespace detail
+
+// A read only reference to a range of bits owned by someone else, typically a
+// bitstring.  It is two words and a bit offset, so it can be passed around and
+// sliced without allocating or copying.  The bits must outlive the view.
+struct bitstring_view {
+    bitstring_view() : data_(nullptr), offset_(0), bit_size_(0) {}
+
+    bitstring_view(const bitstring &bits)
+        : data_(bits.begin()), offset_(0), bit_size_(bits.bit_size()) {}
+
+    bitstring_view(const unsigned char *data, size_t bit_size, size_t offset = 0)
+        : data_(data + offset / 8), offset_(offset % 8), bit_size_(bit_size) {}
+
+    bitstring_view(const_bit_iterator first, size_t bit_size)
+        : data_(first->get_byte()), offset_(first->bit()), bit_size_(bit_size) {}
+
+    bitstring_view substr(size_t index,
+                          size_t len = std::numeric_limits<size_t>::max()) const {
+        if (index > bit_size())
+            IT_PANIC("bitstring_view::substr index out of range");
+        if (len > (bit_size() - index))
+            len = bit_size() - index;
+        return bitstring_view(data_, len, offset_ + index);
+    }
+
+    // Make an owning copy.
+    bitstring bits() const { return bitstring(bit_begin(), bit_size_); }
+
+    friend bool operator==(const bitstring_view &a, const bitstring_view &b) {
+        if (a.bit_size() != b.bit_size())
+            return false;
+        return detail::equal_bits(a.data_, a.offset_, b.data_, b.offset_,
+                                  a.bit_size());
+    }
+
+    friend bool operator!=(const bitstring_view &a, const bitstring_view &b) {
+        return !(a == b);
+    }
+
+    // These allow comparing to the string forms, e.g. view == "@101".
+    friend bool operator==(const bitstring_view &a, const bitstring &b) {
+        return a == bitstring_view(b);
+    }
+    friend bool operator==(const bitstring &a, const bitstring_view &b) {
+        return bitstring_view(a) == b;
+    }
+    friend bool operator!=(const bitstring_view &a, const bitstring &b) {
+        return !(a == b);
+    }
+    friend bool operator!=(const bitstring &a, const bitstring_view &b) {
+        return !(a == b);
+    }
+
+    bool empty() const { return bit_size() == 0; }
+
+    const_bit_iterator bit_begin() const {
+        return const_bit_iterator(const_cast<unsigned char *>(data_), offset_);
+    }
+    const_bit_iterator bit_end() const {
+        return const_bit_iterator(const_cast<unsigned char *>(data_),
+                                  offset_ + bit_size_);
+    }
+
+    // The byte holding the first bit and the bit offset into it.
+    const unsigned char *data() const { return data_; }
+    size_t offset() const { return offset_; }
+
+    size_t byte_size() const { return ((bit_size_ % 8) != 0) + bit_size_ / 8; }
+
+    size_t bit_size() const { return bit_size_; }
+
+    bool at(size_t index) const { return get_bit(data_, offset_ + index); }
+
+    // Index of the first occurrence of pattern at or after start, at any bit
+    // offset, or bitstring::npos.
+    size_t find(const bitstring_view &pattern, size_t start = 0) const {
+        if (start > bit_size_)
+            return bitstring::npos;
+        detail::bit_searcher s(pattern.data_, pattern.offset_,
+                               pattern.bit_size_);
+        auto end = offset_ + bit_size_;
+        auto i = s.find(data_, offset_ + start, end);
+        return i == end ? bitstring::npos : i - offset_;
+    }
+
+    // Every occurrence of pattern, overlapping ones included.
+    std::vector<size_t> find_all(const bitstring_view &pattern) const {
+        std::vector<size_t> found;
+        if (pattern.empty())
+            return found;
+        detail::bit_searcher s(pattern.data_, pattern.offset_,
+                               pattern.bit_size_);
+        auto end = offset_ + bit_size_;
+        for (auto i = s.find(data_, offset_, end); i != end;
+             i = s.find(data_, i + 1, end))
+            found.push_back(i - offset_);
+        return found;
+    }
+
+    // Every offset where pattern, of at most 64 bits, matches with no more
+    // than max_errors bits different.
+    std::vector<size_t> find_all(const bitstring_view &pattern,
+                                 size_t max_errors) const {
+        if (pattern.bit_size() > 64)
+            IT_PANIC("approximate search pattern of " << pattern.bit_size()
+                                                       << " bits, limit is 64");
+        if (!max_errors)
+            return find_all(pattern);
+        std::vector<size_t> found;
+        if (pattern.empty())
+            return found;
+        detail::find_near(data_, offset_, offset_ + bit_size_,
+                          detail::read_bits(pattern.data_, pattern.offset_,
+                                            pattern.bit_size_),
+                          pattern.bit_size_, max_errors, found);
+        for (auto &i : found)
+            i -= offset_;
+        return found;
+    }
+
+  private:
+    const unsigned char *data_;
+    size_t offset_;
+    size_t bit_size_;
+};
+
+inline size_t bitstring::find(const bitstring_view &pattern,
+                              size_t start) const {
+    return bitstring_view(*this).find(pattern, start);
+}
+
+inline std::vector<size_t>
+bitstring::find_all(const bitstring_view &pattern) const {
+    return bitstring_view(*this).find_all(pattern);
+}
+
+inline std::vector<size_t> bitstring::find_all(const bitstring_view &pattern,
+                                               size_t max_errors) const {
+    return bitstring_view(*this).find_all(pattern, max_errors);
+}
+
+inline std::string to_string(const bitstring_view &bits) {
+    if (bits.offset())
+        return to_string(bits.bits());
+    std::string dest;
+    if (!bits.bit_size())
+        return dest;
+    auto first = bits.data();
+    auto last = first + bits.byte_size();
+    if (bits.bit_size() % 8) {
+        dest.reserve(bits.bit_size() + 1);
+        dest += '@';
+        ict::to_bin_string(first, last, dest);
+        dest.resize(bits.bit_size() + 1);
+    } else {
+        dest.reserve(bits.byte_size() * 2 + 1);
+        dest += '#';
+        ict::to_hex_string(first, last, dest);
+    }
+    return dest;
+}
+
+inline std::ostream &operator<<(std::ostream &os, const bitstring_view &bits) {
+    os << to_string(bits);
+    return os;
+}
+
+namespace detail {
+constexpr uint64_t hash_secret[4] = {0xa0761d6478bd642f, 0xe7037ed1a0b428db,
+                                     0x8ebc6af09c88c6e3, 0x589965cc75374cc3};
+
+// wyhash over n bits at bit offset bit (0 to 7) of p, taken as big-endian 64
+// bit words so the result doesn't depend on the offset.  Bits past n are never
+// read and n itself is mixed in, so @0 and @00 differ.
+template <bool Shifted>
+inline uint64_t hash_words(const unsigned char *p, size_t bit, size_t n,
+                           uint64_t seed) {
+    const auto s = hash_secret;
+    auto word = [p, bit](size_t i) {
+        auto q = p + i / CHAR_BIT;
+        if (Shifted)
+            return (load_be64(q) << bit) | (q[8] >> (CHAR_BIT - bit));
+        return load_be64(q);
+    };
+    seed ^= mum64(seed ^ s[0], n ^ s[1]);
+    size_t i = 0;
+    if (n > 384) {
+        // three independent lanes of two words
+        auto a = seed, b = seed;
+        for (; i + 384 <= n; i += 384) {
+            seed = mum64(word(i) ^ s[1], word(i + 64) ^ seed);
+            a = mum64(word(i + 128) ^ s[2], word(i + 192) ^ a);
+            b = mum64(word(i + 256) ^ s[3], word(i + 320) ^ b);
+        }
+        seed ^= a ^ b;
+    }
+    for (; i + 128 <= n; i += 128)
+        seed = mum64(word(i) ^ s[1], word(i + 64) ^ seed);
+    uint64_t x = 0, y = 0;
+    if (n - i >= 64) {
+        x = word(i);
+        i += 64;
+    }
+    if (n > i)
+        y = read_bits(p, bit + i, n - i);
+    return mum64(s[1] ^ n, mum64(x ^ s[1], y ^ seed));
+}
+
+inline uint64_t hash_bits(const unsigned char *p, size_t bit, size_t n,
+                          uint64_t seed) {
+    p += bit / CHAR_BIT;
+    bit %= CHAR_BIT;
+    return bit ? hash_words<true>(p, bit, n, seed)
+               : hash_words<false>(p, 0, n, seed);
+}
+} // namespace detail
+
+// A fast non-cryptographic hash of the bits and their length.  Equal bits give
+// equal hashes whatever their offset in memory.
+inline uint64_t hash(const bitstring_view &bits, uint64_t seed = 0) {
+    return detail::hash_bits(bits.data(), bits.offset(), bits.bit_size(),
+                             seed);
+}
+
+namespace detail {
+// A stack of trivially copyable values that keeps the first N in the object
+// and only goes to the heap when it grows past them.
+template <typename T, size_t N> class inline_stack {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "inline_stack values are copied as bytes");
+
+  public:
+    inline_stack() = default;
+    inline_stack(const inline_stack &) = delete;
+    inline_stack &operator=(const inline_stack &) = delete;
+    ~inline_stack() {
+        if (data_ != local_)
+            delete[] data_;
+    }
+
+    void push_back(T v) {
+        if (size_ == capacity_)
+            grow();
+        data_[size_++] = v;
+    }
+    void pop_back() { --size_; }
+
+    T &back() { return data_[size_ - 1]; }
+    const T &back() const { return data_[size_ - 1]; }
+    T &operator[](size_t i) { return data_[i]; }
+    const T &operator[](size_t i) const { return data_[i]; }
+
+    size_t size() const { return size_; }
+    bool empty() const { return !size_; }
+    T *begin() { return data_; }
+    T *end() { return data_ + size_; }
+
+    // Drop the entries from n on.  n must be at most size().
+    void truncate(size_t n) { size_ = n; }
+
+  private:
+    void grow() {
+        auto p = new T[2 * capacity_];
+        std::memcpy(p, data_, size_ * sizeof(T));
+        if (data_ != local_)
+            delete[] data_;
+        data_ = p;
+        capacity_ *= 2;
+    }
+
+    T *data_ = local_;
+    size_t size_ = 0;
+    size_t capacity_ = N;
+    T local_[N];
+};
+} // namespace detail
+
+// Where an ibitstream was, from ibitstream::checkpoint().
+struct bit_checkpoint {
+    size_t position;
+    uint32_t constraints; // depth of the constraint stack
+    uint32_t marks;       // depth of the mark stack
+    size_t index;         // of this checkpoint among the outstanding ones
+    size_t sequence;      // tells it from a later one at the same index
+};
+
+// Reads bits from a bitstring, a view or raw bytes in place, or from a source
+// that is called for more bytes as they are needed.
+//
+// Positions (tellg(), last_mark(), constraints) are absolute bit counts from
+// the start of the stream, so they keep working when a streaming ibitstream
+// slides its window along.
+struct ibitstream {
+    // Fill up to n bytes at p and return how many were written; 0 means the
+    // input has ended.
+    using source = std::function<size_t(unsigned char *p, size_t n)>;
+
+    ibitstream() = delete;
+
+    ibitstream(const ibitstream &) = delete;
+
+    // The bits are read in place, so they must outlive the stream.
+    ibitstream(const bitstring &bits_) : ibitstream(bitstring_view(bits_)) {}
+
+    ibitstream(const bitstring_view &bits_)
+        : data_(bits_.data()), skew_(bits_.offset()),
+          end_byte_(bits_.data() +
+                    (bits_.offset() + bits_.bit_size() + 7) / 8) {
+        end_bit_list.push_back(bits_.bit_size());
+        mark();
+    }
+
+    // Read bit_size bits of raw bytes, e.g. a mapped_file.
+    ibitstream(const unsigned char *data, size_t bit_size)
+        : ibitstream(bitstring_view(data, bit_size)) {}
+
+    // Stream bits from src, which is asked for at least chunk_bytes at a time.
+    // Only a window of bytes from the current position on is kept, so memory
+    // is bounded by the longest read, peek or view in flight rather than the
+    // length of the input.  Views and peek_view()s into the window are good
+    // until the next read that has to refill it.
+    explicit ibitstream(source src, size_t chunk_bytes = 64 * 1024)
+        : buffered_end_(0), stream_(new refill_state) {
+        stream_->src = std::move(src);
+        stream_->chunk = chunk_bytes ? chunk_bytes : 1;
+        end_bit_list.push_back(npos);
+        mark();
+    }
+
+    static constexpr size_t npos = ~size_t(0);
+
+    void advance() {
+        // ++index;
+        ++bit_index;
+    }
+    void advance(size_t n) {
+        // index += n;
+        bit_index += n;
+    }
+
+    // read up to n bits blindly
+    bitstring read_blind(size_t n) {
+        ensure(bit_index + n);
+        auto f = at(bit_index);
+        advance(n);
+        return bitstring(f, n);
+    }
+
+    // read up to n bits
+    bitstring read(size_t n) {
+        return read_blind(available(n));
+    }
+
+    // Like read_blind(), read() and peek() but return a view of the bits in
+    // place, without allocating or copying.
+    bitstring_view read_blind_view(size_t n) {
+        ensure(bit_index + n);
+        auto v = bitstring_view(at(bit_index), n);
+        advance(n);
+        return v;
+    }
+
+    bitstring_view read_view(size_t n) {
+        return read_blind_view(available(n));
+    }
+
+    bitstring_view peek_view(size_t len, size_t offset = 0) const {
+        ensure(bit_index + offset + len);
+        return bitstring_view(at(bit_index + offset), len);
+    }
+
+    // Read up to n (at most 64, more are taken as 64) bits as an unsigned
+    // number, without creating a bitstring.  Like read(), n is limited to
+    // remaining().
+    template <typename T = uint64_t> T read_uint(size_t n) {
+        n = available(std::min<size_t>(n, 64));
+        auto v = fetch(bit_index, n);
+        advance(n);
+        return static_cast<T>(v);
+    }
+
+    // Same as read_uint() but sign extend the n bit value.
+    template <typename T = int64_t> T read_int(size_t n) {
+        n = available(std::min<size_t>(n, 64));
+        auto v = fetch(bit_index, n);
+        advance(n);
+        if (n && n < 64 && ((v >> (n - 1)) & 1))
+            v |= ~uint64_t(0) << n;
+        return static_cast<T>(static_cast<int64_t>(v));
+    }
+
+    // Return the n (at most 64, more are taken as 64) bits at offset from the
+    // current position as an unsigned number.  The stream is not advanced.
+    // Like peek(), no bounds checking is done.
+    template <typename T = uint64_t>
+    T peek_uint(size_t n, size_t offset = 0) const {
+        n = std::min<size_t>(n, 64);
+        ensure(bit_index + offset + n);
+        return static_cast<T>(fetch(bit_index + offset, n));
+    }
+
+    // Read the bytes up to and including the next one equal to ch, for Dave's
+    // protocol.
+    bitstring read_to(char ch) {
+        size_t k = 0;
+        for (;; ++k) {
+            ensure(bit_index + 8 * (k + 1));
+            auto p = at(bit_index)->get_byte() + k;
+            if (p >= end_byte_)
+                IT_PANIC("read_to: '" << ch << "' not found");
+            if (*p == static_cast<unsigned char>(ch))
+                break;
+        }
+        return read_blind(8 * (k + 1));
     }
 
     // peek ahead
     bitstring peek(size_t len, size_t offset = 0) {
-        return bitstring(bit_index + offset, len);
+        ensure(bit_index + offset + len);
+        return bitstring(at(bit_index + offset), len);
     }
 
-    size_t tellg() const { return bit_index - bits.bit_begin(); }
+    size_t tellg() const { return bit_index; }
 
     ibitstream &seek(size_t n) {
         advance(n);
@@ -607,31 +1809,283 @@ struct ibitstream {
         end_bit_list.push_back(bit_index + length);
     }
 
-    void unconstrain() { end_bit_list.pop_back(); }
+    void unconstrain() {
+        end_bit_list.pop_back();
+        if (end_bit_list.size() < low_constraints_)
+            low_constraints_ = end_bit_list.size();
+    }
 
+    // For a streaming ibitstream whose source hasn't ended yet this is only
+    // known inside a constraint; outside of one it is npos less the position.
     size_t remaining() const { return end_bit_list.back() - bit_index; }
 
     void mark() { marker_bit_list.push_back(bit_index); }
 
-    void unmark() { marker_bit_list.pop_back(); }
-
-    size_t last_mark() const {
-        return marker_bit_list.back() - bits.bit_begin();
-    }
-
-    bool eobits() const { return remaining() <= 0; }
+    void unmark() {
+        marker_bit_list.pop_back();
+        if (marker_bit_list.size() < low_marks_)
+            low_marks_ = marker_bit_list.size();
+    }
+
+    size_t last_mark() const { return marker_bit_list.back(); }
+
+    // Speculative decoding: try one way, and if it fails rewind() and try
+    // another, without rebuilding the stream.
+    //
+    //     auto cp = is.checkpoint();
+    //     try {
+    //         m = a_layout::decode(is);
+    //     } catch (std::exception &) {
+    //         is.rewind(cp);
+    //         m = b_layout::decode(is);
+    //     }
+    //     is.commit(cp);
+    //
+    // A checkpoint holds the position and the depths of the constraint and
+    // mark stacks, which rewind() restores.  Checkpoints nest.  Until it is
+    // committed a streaming ibitstream keeps its input from the checkpoint on.
+    bit_checkpoint checkpoint() {
+        bit_checkpoint cp{bit_index,
+                          static_cast<uint32_t>(end_bit_list.size()),
+                          static_cast<uint32_t>(marker_bit_list.size()),
+                          checkpoints_.size(), ++checkpoint_sequence_};
+        checkpoints_.push_back(
+            {bit_index, cp.sequence, low_constraints_, low_marks_});
+        low_constraints_ = end_bit_list.size();
+        low_marks_ = marker_bit_list.size();
+        return cp;
+    }
+
+    // Go back to cp, dropping the constraints and marks made since.  cp stays
+    // outstanding, so it can be rewound to again.
+    void rewind(const bit_checkpoint &cp) {
+        check(cp);
+        size_t constraints, marks;
+        lows_since(cp.index + 1, constraints, marks);
+        if (constraints < cp.constraints || marks < cp.marks)
+            IT_PANIC("rewind: constraints or marks made before the "
+                     "checkpoint were removed");
+        end_bit_list.truncate(cp.constraints);
+        marker_bit_list.truncate(cp.marks);
+        checkpoints_.truncate(cp.index + 1);
+        low_constraints_ = cp.constraints;
+        low_marks_ = cp.marks;
+        bit_index = cp.position;
+    }
+
+    // Give up the chance to rewind to cp, and to any checkpoint made after it.
+    void commit(const bit_checkpoint &cp) {
+        check(cp);
+        lows_since(cp.index, low_constraints_, low_marks_);
+        checkpoints_.truncate(cp.index);
+    }
+
+    bool eobits() const {
+        ensure(bit_index + 1);
+        return remaining() <= 0;
+    }
+
+    // Bytes held for a streaming ibitstream.
+    size_t buffer_size() const { return stream_ ? stream_->buf.size() : 0; }
 
     friend std::ostream &operator<<(std::ostream &os, const ibitstream &bs) {
-        os << "(" << (bs.bit_index - bs.bits.bit_begin()) << ", "
-           << bs.remaining() << ", " << bs.eobits() << ") " << (bs.bits);
+        // eobits() may refill, so before looking at the buffer
+        auto eob = bs.eobits();
+        // a streaming ibitstream shows what it has buffered
+        auto first = bs.stream_ ? 0 : bs.skew_;
+        auto bytes = static_cast<size_t>(bs.end_byte_ - bs.data_);
+        os << "(" << bs.bit_index << ", " << bs.remaining() << ", " << eob
+           << ") " << bitstring_view(bs.data_, bytes * 8 - first, first);
         return os;
     }
 
   private:
-    const bitstring &bits;
-    const_bit_iterator bit_index;
-    std::vector<const_bit_iterator> end_bit_list;
-    std::vector<const_bit_iterator> marker_bit_list;
+    void check(const bit_checkpoint &cp) const {
+        if (cp.index >= checkpoints_.size() ||
+            checkpoints_[cp.index].sequence != cp.sequence)
+            IT_PANIC("checkpoint at " << cp.position
+                                      << " was already committed");
+    }
+
+    // The lowest the constraint and mark stacks have been since the
+    // checkpoint before checkpoints_[first] was made.  Removing a constraint
+    // or mark and making another at the same depth shows up here, where the
+    // depths alone wouldn't.
+    void lows_since(size_t first, size_t &constraints, size_t &marks) const {
+        constraints = low_constraints_;
+        marks = low_marks_;
+        for (auto i = first; i < checkpoints_.size(); ++i) {
+            auto &e = checkpoints_[i];
+            constraints = std::min(constraints, e.low_constraints);
+            marks = std::min(marks, e.low_marks);
+        }
+    }
+
+    // The input of a streaming ibitstream.  buf holds it from bit base on,
+    // filled bytes of it so far.
+    struct refill_state {
+        source src;
+        size_t chunk;
+        std::vector<unsigned char> buf;
+        size_t base = 0;
+        size_t filled = 0;
+        bool done = false;
+    };
+
+    const_bit_iterator at(size_t pos) const {
+        auto b = pos + skew_;
+        return const_bit_iterator(const_cast<unsigned char *>(data_) + b / 8,
+                                  b % 8);
+    }
+
+    // n limited to what is left, once as much of it as there is is buffered.
+    size_t available(size_t n) {
+        if (n > remaining())
+            n = remaining();
+        if (bit_index + n > buffered_end_) {
+            refill(bit_index + n);
+            if (n > remaining())
+                n = remaining();
+        }
+        return n;
+    }
+
+    // Make sure the bits before end are buffered, or as many of them as the
+    // source has left.  Bits held in memory are always all there.
+    void ensure(size_t end) const {
+        if (end > buffered_end_)
+            refill(end);
+    }
+
+    void refill(size_t end) const {
+        auto &s = *stream_;
+        // Drop the bytes before the current one, or the oldest checkpoint.
+        // The first read may even be past what has been buffered, after a
+        // seek().
+        auto keep = bit_index;
+        if (!checkpoints_.empty())
+            keep = std::min(keep, checkpoints_[0].position);
+        keep = keep / 8 * 8;
+        if (keep > s.base) {
+            auto drop = (keep - s.base) / 8;
+            if (drop < s.filled) {
+                std::memmove(s.buf.data(), s.buf.data() + drop,
+                             s.filled - drop);
+                s.filled -= drop;
+                s.base = keep;
+            } else {
+                // stops short at the end of the input
+                s.base += (s.filled + skip(drop - s.filled)) * 8;
+                s.filled = 0;
+            }
+        }
+        size_t need = (end - s.base + 7) / 8;
+        if (s.buf.size() < need || s.buf.size() - s.filled < s.chunk)
+            s.buf.resize(std::max(need, s.filled + s.chunk));
+        while (s.filled < need && !s.done) {
+            auto got = s.src(s.buf.data() + s.filled, s.buf.size() - s.filled);
+            if (!got)
+                s.done = true;
+            s.filled += got;
+        }
+        // past the end of the input reads as zero
+        if (s.done)
+            std::fill(s.buf.begin() + s.filled, s.buf.end(), 0);
+        if (s.done && buffered_end_ != npos)
+            finish();
+
+        data_ = s.buf.data();
+        skew_ = 0 - s.base;
+        end_byte_ = data_ + s.filled;
+        buffered_end_ = s.done ? npos : s.base + s.filled * 8;
+        window_bits_ = 0;
+    }
+
+    // Throw away up to n bytes of input, returning how many there were.
+    size_t skip(size_t n) const {
+        auto &s = *stream_;
+        unsigned char scratch[512];
+        size_t skipped = 0;
+        while (skipped < n && !s.done) {
+            auto got = s.src(scratch, std::min(n - skipped, sizeof(scratch)));
+            if (!got)
+                s.done = true;
+            skipped += got;
+        }
+        return skipped;
+    }
+
+    // The source has ended, so nothing goes past what it gave.  Constraints
+    // are cut back to that, which keeps remaining() a single subtraction.
+    void finish() const {
+        auto last = stream_->base + stream_->filled * 8;
+        for (auto &e : end_bit_list)
+            if (e > last)
+                e = last;
+    }
+
+    // The integer reads are served from a cached 64 bit window of the bits,
+    // which is reloaded from the byte buffer when a read falls outside of it.
+    uint64_t fetch(size_t pos, size_t n) const {
+        if (!n)
+            return 0;
+        auto first = at(pos);
+        auto p = first->get_byte();
+        if (!window_bits_ || p < window_byte_ ||
+            (p - window_byte_) * 8 + first->bit() + n > window_bits_) {
+            // a peek at an offset past the end of the bits reads as zero
+            if (p >= end_byte_)
+                return 0;
+            auto avail = static_cast<size_t>(end_byte_ - p);
+            if (avail >= 8) {
+                window_ = detail::load_be64(p);
+                window_bits_ = 64;
+            } else {
+                // anything past the end of the bits reads as zero
+                window_ = detail::load_be(p, avail);
+                window_bits_ = avail * 8;
+            }
+            window_byte_ = p;
+            // a 64 bit read that straddles 9 bytes doesn't fit the window
+            if (first->bit() + n > 64 && avail > 8)
+                return detail::read_bits(p, first->bit(), n);
+        }
+        auto off = static_cast<size_t>(p - window_byte_) * 8 + first->bit();
+        return (window_ << off) >> (64 - n);
+    }
+
+    // Bit pos of the stream is bit pos + skew_ of data_.  For a streaming
+    // ibitstream data_ is its buffer, which starts part way into the input.
+    mutable const unsigned char *data_ = nullptr;
+    mutable size_t skew_ = 0;
+    mutable const unsigned char *end_byte_ = nullptr;
+    size_t bit_index = 0;
+    // Constraints and marks nest a handful deep, so building a stream and
+    // the constrain/mark cycle don't allocate.  The source may end under a
+    // constraint, see finish().
+    mutable detail::inline_stack<size_t, 12> end_bit_list;
+    detail::inline_stack<size_t, 12> marker_bit_list;
+    // The outstanding checkpoints, oldest first.  low_constraints_ and
+    // low_marks_ are the lowest the stacks have been since the newest was
+    // made, and each entry holds them as they were for the one before it.
+    struct checkpoint_entry {
+        size_t position;
+        size_t sequence;
+        size_t low_constraints;
+        size_t low_marks;
+    };
+    detail::inline_stack<checkpoint_entry, 4> checkpoints_;
+    size_t checkpoint_sequence_ = 0;
+    size_t low_constraints_ = 0;
+    size_t low_marks_ = 0;
+
+    // npos unless streaming, when bits before it are in the buffer
+    mutable size_t buffered_end_ = npos;
+    std::unique_ptr<refill_state> stream_;
+
+    mutable const unsigned char *window_byte_ = nullptr;
+    mutable uint64_t window_ = 0;
+    mutable size_t window_bits_ = 0;
 };
 
 // use this instead of calling ibitstream::constrain()/unconstrain() pairs.
@@ -660,74 +2114,516 @@ struct bitmarker {
 };
 
 struct obitstream {
-    obitstream(const bitstring &bits) : index(bits.bit_size()), data(1024) {
-        std::copy(bits.begin(), bits.end(), data.begin());
-    }
+    // start the stream with a copy of bits
+    obitstream(const bitstring &bits) : bits_(bits) {}
+
+    // start the stream with bits, taking over their storage
+    obitstream(bitstring &&bits) : bits_(std::move(bits)) {}
 
-    obitstream() : index(0) {}
+    obitstream() {}
 
     obitstream &operator<<(const bitstring &b) {
-        while (((index + b.bit_size() + 8) / 8) > data.size())
-            data.resize(data.size() + 1024);
-        auto dest = bit_iterator(&(data[0]), index);
-        bit_copy(b.bit_begin(), b.bit_end(), dest);
-        index += b.bit_size();
+        flush();
+        bits_.append(b);
         return *this;
     }
 
+    // Append the low n bits of value, padded on the left with zeros past 64
+    // as write_uint() does.  Bits are collected in a 64 bit accumulator and
+    // written out a word at a time.
+    obitstream &write_bits(uint64_t value, size_t n) {
+        if (!n)
+            return *this;
+        if (n > 64)
+            return write_uint(value, n);
+        if (n < 64)
+            value &= ~(~uint64_t(0) << n);
+
+        // The accumulator always starts on a byte boundary, so take back the
+        // bits of a partially written last byte.
+        auto size = bits_.bit_size();
+        if (!acc_bits_ && size % 8) {
+            acc_bits_ = size % 8;
+            size -= acc_bits_;
+            acc_ = bits_.begin()[size / 8] >> (8 - acc_bits_);
+            bits_.set_size(size);
+        }
+
+        auto room = 64 - acc_bits_;
+        if (n < room) {
+            acc_ = (acc_ << n) | value;
+            acc_bits_ += n;
+        } else {
+            // fill the accumulator, write it out and keep the rest
+            auto rest = n - room;
+            auto word = room == 64 ? value : (acc_ << room) | (value >> rest);
+            bits_.grow(size + 64);
+            detail::store_be64(bits_.begin() + size / 8, word);
+            bits_.set_size(size + 64);
+            acc_ = rest ? value & ~(~uint64_t(0) << rest) : 0;
+            acc_bits_ = rest;
+        }
+        return *this;
+    }
+
+    // Append value as an n bit number.  Numbers wider than 64 bits are padded
+    // on the left with zeros.
+    template <typename T>
+    obitstream &write_uint(T value, size_t n = sizeof(T) * 8) {
+        static_assert(std::is_integral<T>::value, "write_uint needs an integer");
+        for (; n > 64; n -= std::min<size_t>(n - 64, 64))
+            write_bits(0, std::min<size_t>(n - 64, 64));
+        return write_bits(static_cast<uint64_t>(value), n);
+    }
+
+    // Write any bits still held in the accumulator to the bitstring.
+    void flush() {
+        if (!acc_bits_)
+            return;
+        auto size = bits_.bit_size();
+        auto word = acc_ << (64 - acc_bits_);
+        auto bytes = (acc_bits_ + 7) / 8;
+        bits_.grow(size + acc_bits_);
+        for (size_t i = 0; i < bytes; ++i)
+            bits_.begin()[size / 8 + i] =
+                static_cast<unsigned char>(word >> (56 - 8 * i));
+        bits_.set_size(size + acc_bits_);
+        acc_ = 0;
+        acc_bits_ = 0;
+    }
+
+    // The number of bits written, including any not yet flushed.
+    size_t bit_size() const { return bits_.bit_size() + acc_bits_; }
+
+    // A copy of the bits written so far.
     bitstring bits() {
-        auto first = const_bit_iterator(&data[0]);
-        return bitstring(first, first + index);
+        flush();
+        return bits_;
+    }
+
+    // Hand over the bits written without copying them.  The stream is left
+    // empty.
+    bitstring take_bits() && {
+        flush();
+        return std::move(bits_);
     }
-    size_t index;
-    // TODO change this to a bitstring and then use move copy for bits()?
-    std::vector<char> data;
+
+  private:
+    bitstring bits_;
+    uint64_t acc_ = 0;
+    size_t acc_bits_ = 0;
 };
 
+namespace detail {
+// Dense 7 bit ASCII keeps the low 7 bits of each character, most significant
+// first, so 8 characters make 56 bits.  The characters of r (the first in the
+// top byte) are squeezed together pairwise in 16, 32 and then 64 bit lanes.
+inline uint64_t compact_ascii7(uint64_t r) {
+    r &= 0x7F7F7F7F7F7F7F7F;
+    r = ((r & 0x7F007F007F007F00) >> 1) | (r & 0x007F007F007F007F);
+    r = ((r & 0x3FFF00003FFF0000) >> 2) | (r & 0x00003FFF00003FFF);
+    return ((r & 0x0FFFFFFF00000000) >> 4) | (r & 0x000000000FFFFFFF);
+}
+
+// The reverse, 56 right aligned bits to 8 characters.
+inline uint64_t expand_ascii7(uint64_t x) {
+    x = ((x << 4) & 0x0FFFFFFF00000000) | (x & 0x000000000FFFFFFF);
+    x = ((x << 2) & 0x3FFF00003FFF0000) | (x & 0x00003FFF00003FFF);
+    return ((x << 1) & 0x7F007F007F007F00) | (x & 0x007F007F007F007F);
+}
+
+// Write the k (1 to 8) characters in the top bytes of r, packed.
+inline unsigned char *put_ascii7(unsigned char *out, uint64_t r, size_t k) {
+    unsigned char word[8];
+    store_be64(word, compact_ascii7(r) << 8);
+    auto bytes = (7 * k + 7) / 8;
+    std::memcpy(out, word, bytes);
+    return out + (k == 8 ? 7 : bytes);
+}
+
+// Pack n characters from in, 8 at a time.
+inline void pack_ascii7(const unsigned char *in, size_t n, unsigned char *out) {
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8)
+        out = put_ascii7(out, load_be64(in + k), 8);
+    if (k < n) {
+        uint64_t r = 0;
+        for (size_t i = k; i < n; ++i)
+            r |= uint64_t(in[i]) << (56 - 8 * (i - k));
+        put_ascii7(out, r, n - k);
+    }
+}
+} // namespace detail
+
+// Pack text into 7 bits per character, dropping the top bit of each.
 template <typename T> bitstring from_ascii7(T first, T last) {
-    obitstream os;
-    while (first != last) {
-        auto i = bit_iterator(&(*first));
-        i++;
-        auto bs = bitstring(i, 7);
-        os << bs;
+    bitstring bits(7 * static_cast<size_t>(std::distance(first, last)));
+    if constexpr (std::is_pointer<T>::value && sizeof(*first) == 1) {
+        detail::pack_ascii7(reinterpret_cast<const unsigned char *>(first),
+                            static_cast<size_t>(last - first), bits.begin());
+    } else {
+        auto out = bits.begin();
+        while (first != last) {
+            uint64_t r = 0;
+            size_t k = 0;
+            for (; k < 8 && first != last; ++k, ++first)
+                r = (r << 8) | static_cast<unsigned char>(*first);
+            out = detail::put_ascii7(out, r << (8 * (8 - k)), k);
+        }
+    }
+    return bits;
+}
+
+// Unpack 7 bit characters into out, which needs room for bit_size() / 7 of
+// them.  Returns the number written.
+inline size_t to_ascii7(const bitstring_view &bits, char *out) {
+    const size_t n = bits.bit_size() / 7;
+    auto p = bits.data();
+    const size_t bytes = (bits.offset() + bits.bit_size() + 7) / 8;
+    size_t bit = bits.offset();
+    size_t k = 0;
+    for (; k + 8 <= n && bit / 8 + 8 <= bytes; k += 8, bit += 56) {
+        auto x = (detail::load_be64(p + bit / 8) << (bit % 8)) >> 8;
+        detail::store_be64(reinterpret_cast<unsigned char *>(out + k),
+                           detail::expand_ascii7(x));
+    }
+    for (; k < n; ++k, bit += 7)
+        out[k] = static_cast<char>(detail::read_bits(p, bit, 7));
+    return n;
+}
+
+inline std::string to_ascii7(const bitstring_view &bits) {
+    std::string text(bits.bit_size() / 7, '\0');
+    to_ascii7(bits, &text[0]);
+    return text;
+}
+
+namespace detail {
+template <size_t Width>
+using uint_least = std::conditional_t<
+    (Width <= 8), uint8_t,
+    std::conditional_t<(Width <= 16), uint16_t,
+                       std::conditional_t<(Width <= 32), uint32_t, uint64_t>>>;
+
+template <size_t Width>
+using int_least = std::make_signed_t<uint_least<Width>>;
+
+// Byte at a time so they can be constexpr.  The expansions are fully unrolled,
+// which compilers merge into a single load (and byte swap) or store; a loop
+// over 8 bytes isn't always.  Sizes other than 1, 2, 4 and 8 are split into
+// those so the pieces merge too.
+template <size_t Bytes> constexpr size_t whole_part() {
+    return Bytes >= 4 ? 4 : Bytes >= 2 ? 2 : 1;
+}
+
+template <size_t... I>
+constexpr uint64_t load_be_n(const unsigned char *p,
+                             std::index_sequence<I...>) {
+    return ((uint64_t(p[I]) << (8 * (sizeof...(I) - 1 - I))) | ... | 0);
+}
+
+template <size_t Bytes> constexpr uint64_t load_be_n(const unsigned char *p) {
+    if constexpr (Bytes == 1 || Bytes == 2 || Bytes == 4 || Bytes == 8) {
+        return load_be_n(p, std::make_index_sequence<Bytes>());
+    } else {
+        constexpr size_t head = whole_part<Bytes>();
+        return (load_be_n<head>(p) << (8 * (Bytes - head))) |
+               load_be_n<Bytes - head>(p + head);
+    }
+}
+
+template <size_t... I>
+constexpr void store_be_n(unsigned char *p, uint64_t x,
+                          std::index_sequence<I...>) {
+    ((p[I] = static_cast<unsigned char>(x >> (8 * (sizeof...(I) - 1 - I)))),
+     ...);
+}
+
+template <size_t Bytes>
+constexpr void store_be_n(unsigned char *p, uint64_t x) {
+    if constexpr (Bytes == 1 || Bytes == 2 || Bytes == 4 || Bytes == 8) {
+        store_be_n(p, x, std::make_index_sequence<Bytes>());
+    } else {
+        constexpr size_t head = whole_part<Bytes>();
+        store_be_n<head>(p, x >> (8 * (Bytes - head)));
+        store_be_n<Bytes - head>(p + head, x);
+    }
+}
+
+template <size_t Width> constexpr uint64_t field_mask() {
+    return Width == 64 ? ~uint64_t(0) : (uint64_t(1) << (Width % 64)) - 1;
+}
+
+// The Width bits at bit Offset of p, right aligned.
+template <size_t Offset, size_t Width>
+constexpr uint64_t extract_bits(const unsigned char *p) {
+    static_assert(Width >= 1 && Width <= 64, "field width must be 1 to 64");
+    constexpr size_t shift = Offset % 8;
+    constexpr size_t span = (shift + Width + 7) / 8;
+    p += Offset / 8;
+    if constexpr (span <= 8) {
+        return (load_be_n<span>(p) >> (span * 8 - shift - Width)) &
+               field_mask<Width>();
+    } else {
+        // a 64 bit field that isn't byte aligned reaches a ninth byte
+        return ((load_be_n<8>(p) << shift) | (p[8] >> (8 - shift))) >>
+               (64 - Width);
+    }
+}
+} // namespace detail
+
+// Fields at offsets and widths fixed at compile time.  Offset counts bits from
+// the most significant bit of p[0] and Width is 1 to 64; no bounds are checked.
+// T defaults to the smallest unsigned type that holds the field.
+template <size_t Offset, size_t Width, typename T = detail::uint_least<Width>>
+constexpr T extract(const unsigned char *p) {
+    return static_cast<T>(detail::extract_bits<Offset, Width>(p));
+}
+
+// The same with the top bit of the field taken as its sign.
+template <size_t Offset, size_t Width, typename T = detail::int_least<Width>>
+constexpr T extract_signed(const unsigned char *p) {
+    static_assert(std::is_signed<T>::value, "extract_signed needs a signed T");
+    constexpr uint64_t sign = uint64_t(1) << (Width - 1);
+    auto x = detail::extract_bits<Offset, Width>(p);
+    // (x ^ sign) - sign sign extends without a signed shift
+    return static_cast<T>(static_cast<int64_t>((x ^ sign) - sign));
+}
+
+// Store the low Width bits of value at bit Offset of p, leaving the bits
+// around the field alone.
+template <size_t Offset, size_t Width, typename T>
+constexpr void insert(unsigned char *p, T value) {
+    static_assert(Width >= 1 && Width <= 64, "field width must be 1 to 64");
+    constexpr size_t shift = Offset % 8;
+    constexpr size_t span = (shift + Width + 7) / 8;
+    auto v = static_cast<uint64_t>(value) & detail::field_mask<Width>();
+    p += Offset / 8;
+    if constexpr (span <= 8) {
+        constexpr size_t low = span * 8 - shift - Width;
+        constexpr uint64_t mask = detail::field_mask<Width>() << low;
+        auto x = detail::load_be_n<span>(p);
+        detail::store_be_n<span>(p, (x & ~mask) | (v << low));
+    } else {
+        constexpr size_t head = 64 - shift; // field bits in the first 8 bytes
+        constexpr uint64_t mask = detail::field_mask<head>();
+        auto x = detail::load_be_n<8>(p);
+        detail::store_be_n<8>(p, (x & ~mask) | (v >> (Width - head)));
+        constexpr unsigned tail_low = 8 - (Width - head);
+        p[8] = static_cast<unsigned char>(
+            (p[8] & ((1u << tail_low) - 1)) | ((v << tail_low) & 0xFF));
+    }
+}
+
+// Outcome of parsing text into a bitstring.  On failure ptr points at the
+// offending character, or at the end of the text if a hex byte is incomplete.
+struct parse_result {
+    const char *ptr;
+    bool ok;
+
+    explicit operator bool() const { return ok; }
+};
+
+namespace detail {
+// Character classes for the scalar parsers: digit values, or one of these.
+enum : unsigned char { parse_space = 0xFE, parse_bad = 0xFF };
+
+struct parse_tables {
+    unsigned char hex[256];
+    unsigned char binary[256];
+    unsigned char reversed[256]; // bits of each byte in reverse order
+
+    constexpr parse_tables() : hex(), binary(), reversed() {
+        for (int c = 0; c < 256; ++c) {
+            bool space = c == ' ' || (c >= '\t' && c <= '\r');
+            unsigned char other = space ? parse_space : parse_bad;
+            hex[c] = other;
+            binary[c] = other;
+            for (int b = 0; b < 8; ++b)
+                if (c & (1 << b))
+                    reversed[c] |= static_cast<unsigned char>(0x80 >> b);
+        }
+        for (int c = '0'; c <= '9'; ++c)
+            hex[c] = static_cast<unsigned char>(c - '0');
+        for (int c = 'a'; c <= 'f'; ++c) {
+            hex[c] = static_cast<unsigned char>(c - 'a' + 10);
+            hex[c - 'a' + 'A'] = static_cast<unsigned char>(c - 'a' + 10);
+        }
+        binary[int('0')] = 0;
+        binary[int('1')] = 1;
+    }
+};
+
+inline constexpr parse_tables parse_table{};
+
+// Size bits for the most digits the text could hold.  parse_finish() trims it.
+inline unsigned char *parse_start(bitstring &bits, size_t max_bits) {
+    bits.clear();
+    bits.resize(max_bits);
+    return bits.begin();
+}
+
+inline parse_result parse_finish(bitstring &bits, size_t n, const char *ptr,
+                                 bool ok) {
+    if (!ok) {
+        bits.clear();
+        return {ptr, false};
+    }
+    bits.resize(n);
+    // don't keep a heap block for bits that fit inline
+    if (!bits.local() && n <= bitstring::local_bits)
+        bits.shrink_to_fit();
+    return {ptr, true};
+}
+} // namespace detail
+
+// Parse hex digits in [first, last) into bits, skipping whitespace.  There
+// must be an even number of digits.  Blocks of 16 digits are validated and
+// packed with SSE2 where available, anything else goes through a table.  On
+// failure bits is left empty.
+inline parse_result parse_hex(const char *first, const char *last,
+                              bitstring &bits) {
+    auto dst = detail::parse_start(bits, (last - first) * 4);
+    auto &table = detail::parse_table.hex;
+    size_t n = 0; // nibbles written
+    auto p = first;
+    while (p != last) {
+#ifdef ICT_HAS_SSE2
+        if (!(n & 1) && last - p >= 16) {
+            auto c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            auto d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+            auto l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+                                  _mm_set1_epi8('a'));
+            auto none = _mm_set1_epi8(-1);
+            auto is_d = _mm_and_si128(_mm_cmpgt_epi8(d, none),
+                                      _mm_cmplt_epi8(d, _mm_set1_epi8(10)));
+            auto is_l = _mm_and_si128(_mm_cmpgt_epi8(l, none),
+                                      _mm_cmplt_epi8(l, _mm_set1_epi8(6)));
+            if (_mm_movemask_epi8(_mm_or_si128(is_d, is_l)) == 0xFFFF) {
+                auto v = _mm_or_si128(
+                    _mm_and_si128(is_d, d),
+                    _mm_and_si128(is_l, _mm_add_epi8(l, _mm_set1_epi8(10))));
+                // each 16 bit lane holds two nibbles, high one first
+                auto w = _mm_or_si128(
+                    _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xFF)), 4),
+                    _mm_srli_epi16(v, 8));
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + n / 2),
+                                 _mm_packus_epi16(w, w));
+                n += 16;
+                p += 16;
+                continue;
+            }
+        }
+#endif
+        auto v = table[static_cast<unsigned char>(*p)];
+        if (v == detail::parse_space) {
+            ++p;
+            continue;
+        }
+        if (v == detail::parse_bad)
+            return detail::parse_finish(bits, 0, p, false);
+        dst[n / 2] |= static_cast<unsigned char>(n & 1 ? v : v << 4);
+        ++n;
+        ++p;
+    }
+    return detail::parse_finish(bits, n * 4, p, !(n & 1));
+}
+
+// Parse '0' and '1' characters in [first, last) into bits, skipping
+// whitespace.  Runs of 16 (SSE2) or 8 characters are handled at once.  On
+// failure bits is left empty.
+inline parse_result parse_binary(const char *first, const char *last,
+                                 bitstring &bits) {
+    auto dst = detail::parse_start(bits, last - first);
+    auto &table = detail::parse_table.binary;
+    size_t n = 0; // bits written
+    auto p = first;
+    while (p != last) {
+        if (!(n & 7)) {
+#ifdef ICT_HAS_SSE2
+            if (last - p >= 16) {
+                auto c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                auto ok = _mm_cmpeq_epi8(_mm_andnot_si128(_mm_set1_epi8(1), c),
+                                         _mm_set1_epi8('0'));
+                if (_mm_movemask_epi8(ok) == 0xFFFF) {
+                    // move each character's low bit to its sign bit
+                    int m = _mm_movemask_epi8(_mm_slli_epi64(c, 7));
+                    auto &rev = detail::parse_table.reversed;
+                    dst[n / 8] = rev[m & 0xFF];
+                    dst[n / 8 + 1] = rev[m >> 8];
+                    n += 16;
+                    p += 16;
+                    continue;
+                }
+            }
+#endif
+            if (last - p >= 8) {
+                auto x = detail::load_be64(
+                    reinterpret_cast<const unsigned char *>(p));
+                if (!((x ^ 0x3030303030303030) & ~0x0101010101010101)) {
+                    // gather the low bit of each byte, first character first
+                    x &= 0x0101010101010101;
+                    dst[n / 8] = static_cast<unsigned char>(
+                        (x * 0x0102040810204080) >> 56);
+                    n += 8;
+                    p += 8;
+                    continue;
+                }
+            }
+        }
+        auto v = table[static_cast<unsigned char>(*p)];
+        if (v == detail::parse_space) {
+            ++p;
+            continue;
+        }
+        if (v == detail::parse_bad)
+            return detail::parse_finish(bits, 0, p, false);
+        dst[n / 8] |= static_cast<unsigned char>(v << (7 - (n & 7)));
+        ++n;
+        ++p;
     }
-    return os.bits();
+    return detail::parse_finish(bits, n, p, true);
+}
+
+// Parse text using the bitstring conventions: after any leading whitespace,
+// '#' starts hex, '@' starts binary, and anything else is hex.
+inline parse_result parse_bitstring(const char *first, const char *last,
+                                    bitstring &bits) {
+    auto p = first;
+    while (p != last &&
+           detail::parse_table.hex[static_cast<unsigned char>(*p)] ==
+               detail::parse_space)
+        ++p;
+    if (p != last && *p == '@')
+        return parse_binary(p + 1, last, bits);
+    if (p != last && *p == '#')
+        ++p;
+    return parse_hex(p, last, bits);
+}
+
+inline bitstring::bitstring(const std::string &str) {
+    parse_bitstring(str.data(), str.data() + str.size(), *this);
+}
+
+inline bitstring::bitstring(const char *str) {
+    parse_bitstring(str, str + std::strlen(str), *this);
 }
 
 inline bitstring::bitstring(int base, const char *str) {
-    std::string s(str);
     switch (base) {
     case 2:
-        if (ict::is_binary(s)) {
-            resize(s.size());
-            for (unsigned i = 0; i < bit_size(); ++i) {
-                set_bit(reinterpret_cast<unsigned char *>(begin()), i,
-                        s[i] == '1');
-            }
-        }
+        parse_binary(str, str + std::strlen(str), *this);
         break;
     case 16:
-        if (ict::is_hex(s)) {
-            resize(s.size() * 4);
-
-            for (unsigned cb = 0, i = 0; i < s.size(); i += 2, ++cb) {
-                char hex_char = str[i];
-                char new_char = static_cast<char>(ict::hex_ascii(hex_char));
-                data()[cb] = static_cast<char>(new_char << 4);
-                new_char = static_cast<char>(ict::hex_ascii(str[1 + i]));
-                data()[cb] |= new_char;
-            }
-        }
+        parse_hex(str, str + std::strlen(str), *this);
         break;
     case 7: // ascii 7
-    {
-        *this = from_ascii7(s.begin(), s.end());
-    } break;
+        *this = from_ascii7(str, str + std::strlen(str));
+        break;
     case 8: // ascii 8
     {
-        auto first = const_bit_iterator(const_cast<char *>(s.c_str()));
-        *this = bitstring(first, first + s.length() * 8);
+        auto first = const_bit_iterator(const_cast<char *>(str));
+        *this = bitstring(first, first + std::strlen(str) * 8);
     } break;
     default:
         IT_WARN("unrecognized base: " << base);
@@ -745,6 +2641,21 @@ template <typename T> inline void reverse_bytes(T &number) {
 #endif
 
 namespace detail {
+// Reinterpret the low bits of v as a T.  Floating point types take the bit
+// pattern of the same sized integer.
+template <typename T> inline T from_bits(uint64_t v) {
+    static_assert(sizeof(T) <= sizeof(uint64_t), "type is too large");
+    if constexpr (std::is_floating_point<T>::value) {
+        typedef typename std::conditional<sizeof(T) == 4, uint32_t,
+                                          uint64_t>::type int_type;
+        auto n = static_cast<int_type>(v);
+        T x;
+        std::memcpy(&x, &n, sizeof(x));
+        return x;
+    } else
+        return static_cast<T>(v);
+}
+
     template <typename Size, typename T>
     auto convert_to_int(void *first, bool swap) {
         Size number = *reinterpret_cast<Size *>(first);
@@ -776,13 +2687,20 @@ inline auto to_integer(bitstring const &bits, bool swap = true) {
             // we are converting a bitstring to a bigger type.  So copy the
             // bitstring into the last bits of the number, leaving the first
             // bits as zero.  Then swap and return.
-            T number = 0;
-            auto dest = bit_iterator(reinterpret_cast<char *>(&number),
-                                     type_size - bits.bit_size());
-            bit_copy(bits.bit_begin(), bits.bit_end(), dest);
-            if (swap)
-                reverse_bytes<T>(number);
-            return number;
+            if constexpr (sizeof(T) <= sizeof(uint64_t)) {
+                auto v = detail::read_bits(bits.begin(), 0, bits.bit_size());
+                if (!swap)
+                    v = detail::byte_swap(v) >> (64 - type_size);
+                return detail::from_bits<T>(v);
+            } else {
+                T number = 0;
+                auto dest = bit_iterator(reinterpret_cast<char *>(&number),
+                                         type_size - bits.bit_size());
+                bit_copy(bits.bit_begin(), bits.bit_end(), dest);
+                if (swap)
+                    reverse_bytes<T>(number);
+                return number;
+            }
             break;
         }
     } else {
@@ -792,10 +2710,29 @@ inline auto to_integer(bitstring const &bits, bool swap = true) {
         // effectively we just remove the first n bits
         ibitstream bs(bits);
         return to_integer<T>(
-            bs.seek(bits.bit_size() - type_size).read(type_size));
+            bs.seek(bits.bit_size() - type_size).read(type_size), swap);
     }
 }
 
+// Same as above but for a view, without copying the bits.  Bits beyond the
+// size of T are taken from the end of the view.  With swap false an 8, 16, 32
+// or 64 bit value has its own bytes reversed, and anything else lands in the
+// high bytes of T, as for a bitstring.
+template <typename T>
+inline T to_integer(const bitstring_view &bits, bool swap = true) {
+    const size_t type_size = sizeof(T) * 8;
+    size_t n = std::min(bits.bit_size(), type_size);
+    if (!n)
+        return T();
+    auto v = detail::read_bits(bits.data(),
+                               bits.offset() + bits.bit_size() - n, n);
+    if (!swap) {
+        auto width = n == 8 || n == 16 || n == 32 || n == 64 ? n : type_size;
+        v = detail::byte_swap(v) >> (64 - width);
+    }
+    return detail::from_bits<T>(v);
+}
+
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
@@ -803,11 +2740,14 @@ inline auto to_integer(bitstring const &bits, bool swap = true) {
 // 11011 (2, 1)
 // 11
 inline bitstring &bitstring::remove(size_t index, size_t len) {
-    obitstream os;
-    if (index > 0)
-        os << bitstring(bit_begin(), index);
-    os << bitstring(bit_begin() + index + len, bit_end());
-    *this = os.bits();
+    if (index > bit_size())
+        IT_PANIC("bitstring::remove index out of range");
+    len = std::min(len, bit_size() - index);
+    // shift the tail down over the removed bits
+    detail::copy_bits(begin(), index + len, begin(), index,
+                      bit_size() - index - len);
+    set_size(bit_size() - len);
+    clear_tail();
     return *this;
 }
 
@@ -829,96 +2769,265 @@ inline bitstring from_integer(T number, size_t dest_size = sizeof(T) * 8) {
                          dest_size);
     } else {
         // dest size is greater than size of T, so pad right with 0 bits
-        bitstring t(dest_size - type_size);
-        std::fill(t.begin(), t.end(), 0);
-        obitstream obs(t);
+        obitstream obs(bitstring(dest_size - type_size));
         obs << from_integer(number);
-        return obs.bits();
+        return std::move(obs).take_bits();
     }
 }
 
 namespace detail {
-inline std::vector<unsigned char>
-unpack_bytes(std::vector<unsigned char> const &packedBytes) {
-    if (packedBytes.empty())
-        return std::vector<unsigned char>();
+// GSM 03.38 packs 7 bit characters least significant bit first, so 8 of them
+// fill 7 bytes exactly.  These work 8 characters to a 64 bit word.
+
+// Move the 8 septets in the low 56 bits of x into the low 7 bits of each byte.
+inline uint64_t spread_septets(uint64_t x) {
+    uint64_t r = 0;
+    for (unsigned i = 0; i < 8; ++i)
+        r |= ((x >> (7 * i)) & 0x7F) << (8 * i);
+    return r;
+}
 
-    const unsigned char _decodeMask[7] = {128, 192, 224, 240, 248, 252, 254};
-    std::vector<char> shiftedBytes((packedBytes.size() * 8) / 7, 0);
+// The reverse of spread_septets().
+inline uint64_t gather_septets(uint64_t r) {
+    uint64_t x = 0;
+    for (unsigned i = 0; i < 8; ++i)
+        x |= ((r >> (8 * i)) & 0x7F) << (7 * i);
+    return x;
+}
 
-    int shiftOffset = 0;
-    int shiftIndex = 0;
+// 0x01 in each byte of v that is zero, for bytes below 0x80.
+inline uint64_t zero_bytes(uint64_t v) {
+    const uint64_t lo = 0x0101010101010101, hi = 0x8080808080808080;
+    return (~((v | hi) - lo) & hi) >> 7;
+}
+
+// 0x80 in each byte of v (all below 0x80) that is a control code or one of
+// [\]^_`{|}~ and DEL, which is where ASCII and the GSM alphabet part ways
+// apart from '@' and '$'.
+inline uint64_t ascii_mismatch(uint64_t v) {
+    const uint64_t lo = 0x0101010101010101, hi = 0x8080808080808080;
+    auto at_least = [&](unsigned c) { return (v + lo * (0x80 - c)) & hi; };
+    return (~at_least(0x20) & hi) | (at_least('[') & ~at_least('a')) |
+           at_least('{');
+}
+
+// Everything maps to itself apart from '@' (0x00) and '$' (0x02).  The word
+// paths only take words where that holds, see gsm7_table for the rest.
+inline uint64_t septets_to_ascii(uint64_t r) {
+    const uint64_t lo = 0x0101010101010101;
+    return r + zero_bytes(r) * '@' + zero_bytes(r ^ (lo * 0x02)) * ('$' - 0x02);
+}
 
-    // Shift the packed bytes to the left according to the offset (position of
-    // the byte)
-    for (auto b = packedBytes.begin(); b != packedBytes.end(); ++b) {
-        if (shiftOffset == 7) {
-            shiftedBytes[shiftIndex] = 0;
-            shiftOffset = 0;
-            shiftIndex++;
+inline uint64_t ascii_to_septets(uint64_t r) {
+    const uint64_t lo = 0x0101010101010101;
+    return r - zero_bytes(r ^ (lo * '@')) * '@' -
+           zero_bytes(r ^ (lo * '$')) * ('$' - 0x02);
+}
+
+// Nonzero if any of the 8 septets in r needs the tables.
+inline uint64_t septets_mismatch(uint64_t r) {
+    const uint64_t lo = 0x0101010101010101;
+    auto mapped = zero_bytes(r) | zero_bytes(r ^ (lo * 0x02));
+    auto moved = zero_bytes(r ^ (lo * '$')) | zero_bytes(r ^ (lo * '@'));
+    return (ascii_mismatch(r) & ~(mapped << 7)) | (moved << 7);
+}
+
+// Nonzero if any of the 8 bytes of text in r needs the tables.
+inline uint64_t text_mismatch(uint64_t r) {
+    const uint64_t hi = 0x8080808080808080;
+    return (r & hi) | ascii_mismatch(r & ~hi);
+}
+
+// The GSM 03.38 default alphabet and its extension table, as Unicode.  The
+// escape (0x1B) shows as a space when nothing from the extension table
+// follows it.
+inline constexpr uint16_t gsm7_alphabet[128] = {
+    0x0040, 0x00A3, 0x0024, 0x00A5, 0x00E8, 0x00E9, 0x00F9, 0x00EC,
+    0x00F2, 0x00C7, 0x000A, 0x00D8, 0x00F8, 0x000D, 0x00C5, 0x00E5,
+    0x0394, 0x005F, 0x03A6, 0x0393, 0x039B, 0x03A9, 0x03A0, 0x03A8,
+    0x03A3, 0x0398, 0x039E, 0x0020, 0x00C6, 0x00E6, 0x00DF, 0x00C9,
+    0x0020, 0x0021, 0x0022, 0x0023, 0x00A4, 0x0025, 0x0026, 0x0027,
+    0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
+    0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+    0x0038, 0x0039, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x003F,
+    0x00A1, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+    0x0048, 0x0049, 0x004A, 0x004B, 0x004C, 0x004D, 0x004E, 0x004F,
+    0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+    0x0058, 0x0059, 0x005A, 0x00C4, 0x00D6, 0x00D1, 0x00DC, 0x00A7,
+    0x00BF, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+    0x0068, 0x0069, 0x006A, 0x006B, 0x006C, 0x006D, 0x006E, 0x006F,
+    0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+    0x0078, 0x0079, 0x007A, 0x00E4, 0x00F6, 0x00F1, 0x00FC, 0x00E0};
+
+inline constexpr uint16_t gsm7_extension[][2] = {
+    {0x0A, 0x000C}, {0x14, 0x005E}, {0x28, 0x007B}, {0x29, 0x007D},
+    {0x2F, 0x005C}, {0x3C, 0x005B}, {0x3D, 0x007E}, {0x3E, 0x005D},
+    {0x40, 0x007C}, {0x65, 0x20AC}};
+
+enum : unsigned { gsm7_escape = 0x1B };
+
+// The number of characters in the tables beyond ASCII.
+constexpr size_t gsm7_wide_count() {
+    size_t n = 0;
+    for (auto c : gsm7_alphabet)
+        n += c >= 0x80;
+    for (auto &e : gsm7_extension)
+        n += e[1] >= 0x80;
+    return n;
+}
+
+struct gsm7_tables {
+    uint16_t extended[128]; // after an escape, 0 if there's nothing
+    uint16_t septet[128];   // for ASCII, gsm7_escape << 8 added if escaped
+    // code point << 16 | septet for the rest, sorted for a binary search
+    uint32_t wide[gsm7_wide_count()];
+
+    constexpr gsm7_tables() : extended(), septet(), wide() {
+        for (auto &s : septet)
+            s = '?';
+        for (unsigned i = 0; i < 128; ++i)
+            if (i != gsm7_escape && gsm7_alphabet[i] < 0x80)
+                septet[gsm7_alphabet[i]] = static_cast<uint16_t>(i);
+        for (auto &e : gsm7_extension) {
+            extended[e[0]] = e[1];
+            if (e[1] < 0x80)
+                septet[e[1]] =
+                    static_cast<uint16_t>(gsm7_escape << 8 | e[0]);
         }
+        size_t n = 0;
+        for (unsigned i = 0; i < 128; ++i)
+            if (gsm7_alphabet[i] >= 0x80)
+                wide[n++] = uint32_t(gsm7_alphabet[i]) << 16 | i;
+        for (auto &e : gsm7_extension)
+            if (e[1] >= 0x80)
+                wide[n++] = uint32_t(e[1]) << 16 | gsm7_escape << 8 | e[0];
+        // an insertion sort, since std::sort isn't constexpr until C++20
+        for (size_t i = 1; i < n; ++i)
+            for (size_t j = i; j && wide[j - 1] > wide[j]; --j) {
+                auto t = wide[j];
+                wide[j] = wide[j - 1];
+                wide[j - 1] = t;
+            }
+    }
+};
 
-        shiftedBytes[shiftIndex] =
-            static_cast<unsigned char>((*b << shiftOffset) & 127);
+inline constexpr gsm7_tables gsm7_table{};
 
-        shiftOffset++;
-        shiftIndex++;
+// Write c as UTF-8, returning the number of bytes (1 to 3).
+inline size_t put_utf8(unsigned char *out, unsigned c) {
+    if (c < 0x80) {
+        out[0] = static_cast<unsigned char>(c);
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = static_cast<unsigned char>(0xC0 | c >> 6);
+        out[1] = static_cast<unsigned char>(0x80 | (c & 0x3F));
+        return 2;
     }
+    out[0] = static_cast<unsigned char>(0xE0 | c >> 12);
+    out[1] = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3F));
+    out[2] = static_cast<unsigned char>(0x80 | (c & 0x3F));
+    return 3;
+}
 
-    unsigned moveOffset = 0;
-    unsigned moveIndex = 0;
-    unsigned unpackIndex = 1;
-    std::vector<unsigned char> unpackedBytes(shiftedBytes.size(), 0);
+// The septet for the UTF-8 character at p, gsm7_escape << 8 added if it is
+// in the extension table, moving p past it.  Characters the alphabet doesn't
+// have, and bytes that aren't UTF-8, give '?'.
+inline unsigned next_septet(const unsigned char *&p, const unsigned char *end) {
+    unsigned c = *p++;
+    if (c < 0x80)
+        return gsm7_table.septet[c];
+    size_t more = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+    if (!more)
+        return '?';
+    c &= 0x3Fu >> more;
+    for (; more && p != end && (*p & 0xC0) == 0x80; --more)
+        c = c << 6 | (*p++ & 0x3Fu);
+    if (more || c < 0x80 || c > 0xFFFF)
+        return '?';
+    auto &wide = gsm7_table.wide;
+    auto w = std::lower_bound(std::begin(wide), std::end(wide), c << 16);
+    return w != std::end(wide) && *w >> 16 == c ? *w & 0xFFFF : '?';
+}
 
-    if (shiftedBytes.size() > 0)
-        unpackedBytes[unpackIndex - 1] = shiftedBytes[unpackIndex - 1];
+// The septet starting at bit bit (counted from the low bit of p[0]).
+inline unsigned septet_at(const unsigned char *p, size_t bit) {
+    unsigned v = p[bit / 8] >> (bit % 8);
+    if (bit % 8 > 1)
+        v |= static_cast<unsigned>(p[bit / 8 + 1]) << (8 - bit % 8);
+    return v & 0x7F;
+}
 
-    // Move the bits to the appropriate byte (unpack the bits)
-    for (auto b = packedBytes.begin(); b != packedBytes.end(); ++b) {
-        if (unpackIndex != shiftedBytes.size()) {
-            if (moveOffset == 7) {
-                moveOffset = 0;
-                unpackIndex++;
-                unpackedBytes[unpackIndex - 1] = shiftedBytes[unpackIndex - 1];
-            }
+// Unpack every septet in bytes [p, p + bytes) after fill_bits into out.
+// Returns the number written.
+inline size_t unpack_septets(const unsigned char *p, size_t bytes,
+                             size_t fill_bits, unsigned char *out) {
+    if (bytes * 8 < fill_bits)
+        return 0;
+    const size_t n = (bytes * 8 - fill_bits) / 7;
+    size_t k = 0;
+    size_t bit = fill_bits;
+    for (; k + 8 <= n && bit / 8 + 8 <= bytes; k += 8, bit += 56) {
+        auto r = spread_septets(load_le64(p + bit / 8) >> (bit % 8));
+        store_le64(out + k, r);
+    }
+    for (; k < n; ++k, bit += 7)
+        out[k] = static_cast<unsigned char>(septet_at(p, bit));
+    return n;
+}
 
-            if (unpackIndex != shiftedBytes.size()) {
-                // Extract the bits to be moved
-                int extractedBitsByte =
-                    (packedBytes[moveIndex] & _decodeMask[moveOffset]);
-                // Shift the extracted bits to the proper offset
-                extractedBitsByte = (extractedBitsByte >> (7 - moveOffset));
-                // Move the bits to the appropriate byte (unpack the bits)
-                int movedBitsByte =
-                    (extractedBitsByte | shiftedBytes[unpackIndex]);
-
-                unpackedBytes[unpackIndex] = static_cast<unsigned char>(movedBitsByte);
-
-                moveOffset++;
-                unpackIndex++;
-                moveIndex++;
+// Decode the first n septets in bytes [p, p + bytes) after fill_bits into
+// out as UTF-8, 8 at a time while they need no table.  Returns the number of
+// bytes written, at most 2 * n.
+inline size_t decode_septets(const unsigned char *p, size_t bytes,
+                             size_t fill_bits, size_t n, unsigned char *out) {
+    size_t o = 0;
+    bool escaped = false;
+    auto put = [&](unsigned v) {
+        if (escaped) {
+            escaped = false;
+            if (auto c = gsm7_table.extended[v]) {
+                o += put_utf8(out + o, c);
+                return;
             }
+        } else if (v == gsm7_escape) {
+            escaped = true;
+            return;
         }
-    }
+        o += put_utf8(out + o, gsm7_alphabet[v]);
+    };
+    size_t k = 0;
+    size_t bit = fill_bits;
+    for (; k + 8 <= n && bit / 8 + 8 <= bytes; k += 8, bit += 56) {
+        auto r = spread_septets(load_le64(p + bit / 8) >> (bit % 8));
+        if (!escaped && !septets_mismatch(r)) {
+            store_le64(out + o, septets_to_ascii(r));
+            o += 8;
+            continue;
+        }
+        for (unsigned i = 0; i < 8; ++i)
+            put((r >> (8 * i)) & 0x7F);
+    }
+    for (; k < n; ++k, bit += 7)
+        put(septet_at(p, bit));
+    if (escaped)
+        out[o++] = ' ';
+    return o;
+}
 
+inline std::vector<unsigned char>
+unpack_bytes(std::vector<unsigned char> const &packedBytes) {
+    std::vector<unsigned char> unpacked(packedBytes.size() * 8 / 7);
+    unpack_septets(packedBytes.data(), packedBytes.size(), 0, unpacked.data());
     // Remove the padding if exists
-    if (unpackedBytes[unpackedBytes.size() - 1] == 0)
-        unpackedBytes.pop_back();
-
-    return unpackedBytes;
+    if (!unpacked.empty() && unpacked.back() == 0)
+        unpacked.pop_back();
+    return unpacked;
 }
 
 inline void map_to_ascii(std::vector<unsigned char> &unpacked) {
-    for (auto it = unpacked.begin(); it != unpacked.end(); ++it) {
-        switch (*it) {
-        case 0x00:
-            *it = '@';
-            break;
-        case 0x02:
-            *it = '$';
-            break;
-        }
-    }
+    for (auto &c : unpacked)
+        c = static_cast<unsigned char>(c == 0 ? '@' : c == 2 ? '$' : c);
 }
 
 inline std::vector<unsigned char> to_uchar_array(bitstring const &bs) {
@@ -928,23 +3037,14 @@ inline std::vector<unsigned char> to_uchar_array(bitstring const &bs) {
     return dest;
 }
 
-inline std::string calc_gsm7(const bitstring &bsp) {
-    if (!bsp.empty()) {
-        std::vector<unsigned char> packed = to_uchar_array(bsp);
-        std::vector<unsigned char> unpacked = unpack_bytes(packed);
-        map_to_ascii(unpacked);
-        return std::string(unpacked.begin(), unpacked.end());
-    }
-    return std::string();
-}
-
-// Replace the bits starting at index with bs
+// Replace the bits starting at index with bs, in place.  Bits that would go
+// past the end of src are dropped.
 inline bitstring &replace_bits(bitstring &src, size_t index,
                                bitstring const &bs) {
-    const_bit_iterator first = bs.bit_begin();
-    const_bit_iterator last = bs.bit_end();
-    bit_iterator dest = src.bit_begin() + index;
-    bit_copy(first, last, dest);
+    if (index >= src.bit_size())
+        return src;
+    auto n = std::min(bs.bit_size(), src.bit_size() - index);
+    bit_copy_n(bs.bit_begin(), n, src.bit_begin() + index);
     return src;
 }
 
@@ -957,9 +3057,8 @@ inline bitstring pad_left(bitstring const &bits, size_t width = 8) {
 }
 
 inline bitstring &pad_right(bitstring &bits, size_t new_width) {
-    auto more = new_width - bits.bit_size();
-    if (more > 0)
-        bits.resize(more);
+    if (new_width > bits.bit_size())
+        bits.resize(new_width);
     return bits;
 }
 } // namespace detail
@@ -973,31 +3072,135 @@ inline bitstring random_bitstring(size_t bit_len) {
     return ict::bitstring(bit_iterator(reinterpret_cast<char*>(v.data())), bit_len);
 }
 
-inline std::string gsm7(const bitstring &bits, size_t fill_bits = 0) {
-    if (fill_bits == 0)
-        return detail::calc_gsm7(bits);
+// The most bytes gsm7_decode() can produce from bit_size bits.
+inline size_t gsm7_size(size_t bit_size, size_t fill_bits = 0) {
+    auto bits = bit_size / 8 * 8;
+    return bits < fill_bits ? 0 : (bits - fill_bits) / 7 * 2;
+}
 
-    auto bs = bits;
-    size_t len = fill_bits;
+// Decode the GSM 7 bit characters in the whole bytes of bits into out as
+// UTF-8, skipping fill_bits at the start (the low bits of the first byte).
+// out needs room for gsm7_size() bytes.  When the septets fill the last byte
+// exactly, a final CR or zero septet is taken as padding and dropped.
+// Returns the number of bytes written.
+inline size_t gsm7_decode(const bitstring_view &bits, char *out,
+                          size_t fill_bits = 0) {
+    auto decode = [&](const unsigned char *p) -> size_t {
+        auto bytes = bits.bit_size() / 8;
+        if (bytes * 8 < fill_bits)
+            return 0;
+        auto n = (bytes * 8 - fill_bits) / 7;
+        if (n && (fill_bits + 7 * n) % 8 == 0) {
+            auto last = detail::septet_at(p, fill_bits + 7 * (n - 1));
+            if (last == 0 || last == '\r')
+                --n;
+        }
+        return detail::decode_septets(p, bytes, fill_bits, n,
+                                      reinterpret_cast<unsigned char *>(out));
+    };
+    if (!bits.offset())
+        return decode(bits.data());
+    auto aligned = bits.bits();
+    return decode(aligned.begin());
+}
 
-    // remove the fill bits
-    bs.remove(8 - fill_bits, len);
+// The number of septets the n bytes of UTF-8 text take, counting two for
+// characters from the extension table.
+inline size_t gsm7_length(const char *text, size_t n) {
+    auto p = reinterpret_cast<const unsigned char *>(text);
+    auto end = p + n;
+    size_t len = 0;
+    while (p != end) {
+        if (end - p >= 8 && !detail::text_mismatch(detail::load_le64(p))) {
+            p += 8;
+            len += 8;
+        } else {
+            len += detail::next_septet(p, end) >> 8 ? 2 : 1;
+        }
+    }
+    return len;
+}
 
-    // get the first character
-    auto pre = bitstring(bs.bit_begin(), 7);
-    pre = detail::pad_left(pre, 8);
-    auto first = gsm7(pre);
+// The number of bytes gsm7_encode() writes for n septets.
+inline size_t gsm7_encoded_size(size_t n, size_t fill_bits = 0) {
+    return (fill_bits + 7 * n + 7) / 8;
+}
 
-    // get the remaining string
-    auto post = bs.substr(7, bs.bit_size() - 7);
-    auto rem = gsm7(post);
+// Pack n bytes of UTF-8 text into out as GSM 7 bit septets after fill_bits
+// zero bits, the inverse of gsm7_decode().  Characters from the extension
+// table take an escape first, and ones the alphabet lacks become '?'.  Seven
+// spare bits at the end are filled with a CR, otherwise spare bits are zero.
+// Returns the number of bytes written, gsm7_encoded_size(gsm7_length()).
+inline size_t gsm7_encode(const char *text, size_t n, unsigned char *out,
+                          size_t fill_bits = 0) {
+    auto start = out;
+    uint64_t acc = 0; // pending bits, the oldest in the low bits
+    size_t acc_bits = fill_bits % 8;
+    out += fill_bits / 8;
+    std::fill(start, out, 0);
+    auto put = [&](uint64_t c) {
+        acc |= c << acc_bits;
+        acc_bits += 7;
+        for (; acc_bits >= 8; acc_bits -= 8, acc >>= 8)
+            *out++ = static_cast<unsigned char>(acc);
+    };
+    auto p = reinterpret_cast<const unsigned char *>(text);
+    auto end = p + n;
+    while (p != end) {
+        if (end - p >= 8) {
+            auto r = detail::load_le64(p);
+            if (!detail::text_mismatch(r)) {
+                acc |= detail::gather_septets(detail::ascii_to_septets(r))
+                       << acc_bits;
+                unsigned char word[8];
+                detail::store_le64(word, acc);
+                std::memcpy(out, word, 7);
+                out += 7;
+                acc >>= 56;
+                p += 8;
+                continue;
+            }
+        }
+        auto c = detail::next_septet(p, end);
+        if (c >> 8)
+            put(detail::gsm7_escape);
+        put(c & 0x7F);
+    }
+    if (acc_bits == 1)
+        put('\r');
+    if (acc_bits)
+        *out++ = static_cast<unsigned char>(acc);
+    return static_cast<size_t>(out - start);
+}
 
-    std::ostringstream os;
-    os << first << rem;
-    return os.str();
+inline bitstring to_gsm7(const std::string &text, size_t fill_bits = 0) {
+    auto n = gsm7_length(text.data(), text.size());
+    bitstring bits(gsm7_encoded_size(n, fill_bits) * 8);
+    gsm7_encode(text.data(), text.size(), bits.begin(), fill_bits);
+    return bits;
+}
+
+inline std::string gsm7(const bitstring &bits, size_t fill_bits = 0) {
+    std::string text(gsm7_size(bits.bit_size(), fill_bits), '\0');
+    text.resize(gsm7_decode(bits, &text[0], fill_bits));
+    return text;
 }
 
 inline std::string to_bin_string(const bitstring &bits) {
     return ict::to_bin_string(bits.begin(), bits.end(), bits.bit_size());
 }
 } // namespace ict
+
+namespace std {
+template <> struct hash<ict::bitstring> {
+    size_t operator()(const ict::bitstring &bits) const {
+        return static_cast<size_t>(ict::hash(bits));
+    }
+};
+
+template <> struct hash<ict::bitstring_view> {
+    size_t operator()(const ict::bitstring_view &bits) const {
+        return static_cast<size_t>(ict::hash(bits));
+    }
+};
+} // namespace std
@@ -0,0 +1,251 @@
+#pragma once
+#include "bitstring.h"
+#include <vector>
+
+namespace ict {
+// The parameters of a CRC in the usual catalogue form.  poly is written
+// normally, most significant term first, without the x^width term.
+struct crc_spec {
+    unsigned width; // 1 to 64
+    uint64_t poly;
+    uint64_t init;
+    bool refin;
+    bool refout;
+    uint64_t xorout;
+};
+
+// Common presets, named as in the CRC catalogue.  Each one's check value (the
+// CRC of the ASCII text "123456789") is in the comment.
+inline constexpr crc_spec crc8{8, 0x07, 0, false, false, 0};  // 0xF4
+inline constexpr crc_spec crc16_ibm_3740{16, 0x1021, 0xFFFF, false, false,
+                                         0}; // 0x29B1, a.k.a. CCITT-FALSE
+inline constexpr crc_spec crc16_arc{16, 0x8005, 0, true, true, 0}; // 0xBB3D
+inline constexpr crc_spec crc16_x25{16,   0x1021, 0xFFFF,
+                                    true, true,   0xFFFF}; // 0x906E
+inline constexpr crc_spec crc24_openpgp{24,    0x864CFB, 0xB704CE,
+                                        false, false,    0}; // 0x21CF02
+inline constexpr crc_spec crc24_lte_a{24,    0x864CFB, 0,
+                                      false, false,    0}; // 0xCDE703
+inline constexpr crc_spec crc24_lte_b{24,    0x800063, 0,
+                                      false, false,    0}; // 0x23EF52
+inline constexpr crc_spec crc32{32,   0x04C11DB7, 0xFFFFFFFF,
+                                true, true,       0xFFFFFFFF}; // 0xCBF43926
+inline constexpr crc_spec crc32c{32,   0x1EDC6F41, 0xFFFFFFFF,
+                                 true, true,       0xFFFFFFFF}; // 0xE3069283
+
+namespace detail {
+// The low width bits of x in reverse order.
+inline uint64_t reflect(uint64_t x, unsigned width) {
+    uint64_t r = 0;
+    for (unsigned i = 0; i < width; ++i, x >>= 1)
+        r = (r << 1) | (x & 1);
+    return r;
+}
+
+inline uint64_t low_mask(unsigned width) {
+    return width >= 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+}
+} // namespace detail
+
+// A table driven CRC over any number of bits at any bit offset.
+//
+// The register is kept left aligned in 64 bits for normal CRCs and right
+// aligned for reflected ones, so one set of code handles every width.  Whole
+// 64 bit words go through slice-by-8 tables, leftover bytes through the first
+// table, and the last few bits are shifted in one at a time.  Reflected CRCs
+// take each byte least significant bit first, and a trailing partial byte of
+// n bits as an n bit number, least significant bit first.
+class crc {
+  public:
+    explicit crc(const crc_spec &spec) : spec_(spec), table_(8 * 256) {
+        if (spec.width < 1 || spec.width > 64)
+            IT_PANIC("invalid crc width " << spec.width);
+        const auto w = spec.width;
+        if (spec.refin)
+            poly_ = detail::reflect(spec.poly, w);
+        else
+            poly_ = spec.poly << (64 - w);
+        for (unsigned b = 0; b < 256; ++b) {
+            uint64_t r = spec.refin ? b : uint64_t(b) << 56;
+            for (int i = 0; i < 8; ++i)
+                r = shift1(r);
+            table_[b] = r;
+        }
+        // table k is the effect of a byte followed by k zero bytes
+        for (size_t k = 1; k < 8; ++k) {
+            for (unsigned b = 0; b < 256; ++b) {
+                auto r = table_[(k - 1) * 256 + b];
+                table_[k * 256 + b] = spec.refin
+                                          ? (r >> 8) ^ table_[r & 0xFF]
+                                          : (r << 8) ^ table_[r >> 56];
+            }
+        }
+    }
+
+    const crc_spec &spec() const { return spec_; }
+
+    uint64_t operator()(const bitstring_view &bits) const {
+        return finish(update(start(), bits));
+    }
+
+    // The CRC of the next len bits of a stream, which is not advanced.
+    uint64_t operator()(const ibitstream &is, size_t len) const {
+        return (*this)(is.peek_view(std::min(len, is.remaining())));
+    }
+
+    // Incremental use: finish(update(update(start(), a), b)) is the CRC of
+    // a followed by b.  For reflected CRCs a must be whole bytes.
+    uint64_t start() const {
+        auto init = spec_.init & detail::low_mask(spec_.width);
+        return spec_.refin ? detail::reflect(init, spec_.width)
+                           : init << (64 - spec_.width);
+    }
+
+    uint64_t update(uint64_t reg, const bitstring_view &bits) const {
+        auto p = bits.data();
+        size_t bit = bits.offset();
+        size_t n = bits.bit_size();
+        const uint64_t *t = table_.data();
+        if (spec_.refin) {
+            for (; n >= 64; n -= 64, bit += 64) {
+                reg ^= detail::byte_swap(word(p, bit));
+                reg = t[7 * 256 + (reg & 0xFF)] ^
+                      t[6 * 256 + ((reg >> 8) & 0xFF)] ^
+                      t[5 * 256 + ((reg >> 16) & 0xFF)] ^
+                      t[4 * 256 + ((reg >> 24) & 0xFF)] ^
+                      t[3 * 256 + ((reg >> 32) & 0xFF)] ^
+                      t[2 * 256 + ((reg >> 40) & 0xFF)] ^
+                      t[1 * 256 + ((reg >> 48) & 0xFF)] ^ t[reg >> 56];
+            }
+            for (; n >= 8; n -= 8, bit += 8)
+                reg = (reg >> 8) ^
+                      t[(reg ^ detail::read_bits(p, bit, 8)) & 0xFF];
+            if (n) {
+                reg ^= detail::read_bits(p, bit, n);
+                for (size_t i = 0; i < n; ++i)
+                    reg = shift1(reg);
+            }
+        } else {
+            for (; n >= 64; n -= 64, bit += 64) {
+                reg ^= word(p, bit);
+                reg = t[7 * 256 + (reg >> 56)] ^
+                      t[6 * 256 + ((reg >> 48) & 0xFF)] ^
+                      t[5 * 256 + ((reg >> 40) & 0xFF)] ^
+                      t[4 * 256 + ((reg >> 32) & 0xFF)] ^
+                      t[3 * 256 + ((reg >> 24) & 0xFF)] ^
+                      t[2 * 256 + ((reg >> 16) & 0xFF)] ^
+                      t[1 * 256 + ((reg >> 8) & 0xFF)] ^ t[reg & 0xFF];
+            }
+            for (; n >= 8; n -= 8, bit += 8)
+                reg = (reg << 8) ^
+                      t[(reg >> 56) ^ detail::read_bits(p, bit, 8)];
+            if (n) {
+                reg ^= detail::read_bits(p, bit, n) << (64 - n);
+                for (size_t i = 0; i < n; ++i)
+                    reg = shift1(reg);
+            }
+        }
+        return reg;
+    }
+
+    uint64_t finish(uint64_t reg) const {
+        const auto w = spec_.width;
+        auto v = spec_.refin ? reg : reg >> (64 - w);
+        if (spec_.refin != spec_.refout)
+            v = detail::reflect(v, w);
+        return (v ^ spec_.xorout) & detail::low_mask(w);
+    }
+
+  private:
+    // Shift one zero bit through the register.
+    uint64_t shift1(uint64_t r) const {
+        if (spec_.refin)
+            return r & 1 ? (r >> 1) ^ poly_ : r >> 1;
+        return r >> 63 ? (r << 1) ^ poly_ : r << 1;
+    }
+
+    static uint64_t word(const unsigned char *p, size_t bit) {
+        return bit % 8 ? detail::read_bits(p, bit, 64)
+                       : detail::load_be64(p + bit / 8);
+    }
+
+    crc_spec spec_;
+    uint64_t poly_; // aligned like the register
+    std::vector<uint64_t> table_;
+};
+
+// The RFC 1071 ones' complement sum of 16 bit big-endian words, as used by IP,
+// UDP and TCP.  A length that isn't a multiple of 16 is padded with zeros.
+inline uint16_t internet_checksum(const bitstring_view &bits) {
+    auto p = bits.data();
+    size_t bit = bits.offset();
+    size_t n = bits.bit_size();
+    // 2^16 is 1 modulo 2^16 - 1, so wider words can be summed and folded
+    uint64_t sum = 0;
+    for (; n >= 64; n -= 64, bit += 64) {
+        auto w = bit % 8 ? detail::read_bits(p, bit, 64)
+                         : detail::load_be64(p + bit / 8);
+        sum += (w >> 32) + (w & 0xFFFFFFFF);
+    }
+    if (n) {
+        auto w = detail::read_bits(p, bit, n) << (64 - n);
+        sum += (w >> 32) + (w & 0xFFFFFFFF);
+    }
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return static_cast<uint16_t>(~sum);
+}
+
+inline uint16_t internet_checksum(const ibitstream &is, size_t len) {
+    return internet_checksum(is.peek_view(std::min(len, is.remaining())));
+}
+
+// Fletcher-16 over bytes.  A trailing partial byte is padded with zeros.
+inline uint16_t fletcher16(const bitstring_view &bits) {
+    auto p = bits.data();
+    size_t bit = bits.offset();
+    const size_t end = bit + bits.bit_size();
+    size_t bytes = (bits.bit_size() + 7) / 8;
+    uint64_t c0 = 0, c1 = 0;
+    for (size_t chunk = 1; bytes; bit += 64, ++chunk) {
+        auto w = detail::window64(p, bit, end);
+        auto k = std::min<size_t>(bytes, 8);
+        bytes -= k;
+        for (size_t i = 0; i < k; ++i, w <<= 8) {
+            c0 += w >> 56;
+            c1 += c0;
+        }
+        // 64 bit sums are reduced long before they could overflow
+        if (chunk % 4096 == 0) {
+            c0 %= 255;
+            c1 %= 255;
+        }
+    }
+    return static_cast<uint16_t>(((c1 % 255) << 8) | (c0 % 255));
+}
+
+// Fletcher-32 over 16 bit words taken low byte first, as most implementations
+// read them.  The length is padded with zeros to a whole word.
+inline uint32_t fletcher32(const bitstring_view &bits) {
+    auto p = bits.data();
+    size_t bit = bits.offset();
+    const size_t end = bit + bits.bit_size();
+    size_t words = (bits.bit_size() + 15) / 16;
+    uint64_t c0 = 0, c1 = 0;
+    for (size_t chunk = 1; words; bit += 64, ++chunk) {
+        auto w = detail::window64(p, bit, end);
+        auto k = std::min<size_t>(words, 4);
+        words -= k;
+        for (size_t i = 0; i < k; ++i, w <<= 16) {
+            auto be = w >> 48;
+            c0 += (be >> 8) | ((be & 0xFF) << 8);
+            c1 += c0;
+        }
+        if (chunk % 4096 == 0) {
+            c0 %= 65535;
+            c1 %= 65535;
+        }
+    }
+    return static_cast<uint32_t>(((c1 % 65535) << 16) | (c0 % 65535));
+}
+} // namespace ict
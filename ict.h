@@ -475,9 +475,22 @@ inline std::vector<char> read_stream(std::istream &in) {
 
 template <typename T> inline std::vector<char> read_file(const T &filename) {
     std::vector<char> contents;
-    std::ifstream file(filename.c_str(), std::ios::binary);
-    std::copy(std::istreambuf_iterator<char>(file),
-              std::istreambuf_iterator<char>(), std::back_inserter(contents));
+    std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+    auto size = file.tellg();
+    if (size > 0) {
+        // one read of the whole file
+        contents.resize(static_cast<size_t>(size));
+        file.seekg(0);
+        file.read(contents.data(), size);
+        contents.resize(static_cast<size_t>(file.gcount()));
+    } else if (file) {
+        // not seekable, or a size the file system doesn't know
+        file.clear();
+        file.seekg(0);
+        std::copy(std::istreambuf_iterator<char>(file),
+                  std::istreambuf_iterator<char>(),
+                  std::back_inserter(contents));
+    }
     return contents;
 }
 inline std::vector<char> read_file(const char *filename) {
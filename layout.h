@@ -0,0 +1,269 @@
+#pragma once
+#include "bitstring.h"
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace ict {
+// Field descriptors for a layout.  Member is a pointer to an integral, enum or
+// bool data member of the message struct, Width its size in bits (1 to 64).
+// Signed members are sign extended from Width bits.
+template <auto Member, size_t Width> struct field {
+    static_assert(Width >= 1 && Width <= 64, "field width must be 1 to 64");
+    static constexpr auto member = Member;
+    static constexpr size_t width = Width;
+    static constexpr bool optional = false;
+    static constexpr bool padding = false;
+
+    template <typename Msg> static constexpr bool present(const Msg &) {
+        return true;
+    }
+};
+
+// A field that is only there when Present(msg) is true.  Present is a function
+// taking the message, which is called with the fields before this one already
+// decoded.  An absent member keeps its value initialized value.
+template <auto Member, size_t Width, auto Present>
+struct optional_field : field<Member, Width> {
+    static constexpr bool optional = true;
+
+    template <typename Msg> static constexpr bool present(const Msg &m) {
+        return Present(m);
+    }
+};
+
+// Width reserved bits, skipped when decoding and written as zeros.
+template <size_t Width> struct pad {
+    static constexpr auto member = nullptr;
+    static constexpr size_t width = Width;
+    static constexpr bool optional = false;
+    static constexpr bool padding = true;
+
+    template <typename Msg> static constexpr bool present(const Msg &) {
+        return true;
+    }
+};
+
+namespace detail {
+template <typename> struct member_of;
+
+template <typename C, typename V> struct member_of<V C::*> {
+    using type = V;
+};
+
+template <typename V, size_t Width> constexpr V from_field(uint64_t x) {
+    if constexpr (std::is_same<V, bool>::value) {
+        return x != 0;
+    } else if constexpr (std::is_enum<V>::value) {
+        return static_cast<V>(from_field<std::underlying_type_t<V>, Width>(x));
+    } else if constexpr (std::is_signed<V>::value) {
+        constexpr uint64_t sign = uint64_t(1) << (Width - 1);
+        return static_cast<V>(static_cast<int64_t>((x ^ sign) - sign));
+    } else {
+        return static_cast<V>(x);
+    }
+}
+
+template <typename V> constexpr uint64_t to_field(V v) {
+    if constexpr (std::is_enum<V>::value)
+        return static_cast<uint64_t>(static_cast<std::underlying_type_t<V>>(v));
+    else
+        return static_cast<uint64_t>(v);
+}
+
+// Or the low n (1 to 64) bits of v into p at bit offset bit.  The bits there
+// must be zero.
+inline void or_bits(unsigned char *p, size_t bit, uint64_t v, size_t n) {
+    p += bit / CHAR_BIT;
+    bit %= CHAR_BIT;
+    size_t bytes = (bit + n + 7) / CHAR_BIT;
+    if (bytes <= 8) {
+        auto x = (v << (64 - n)) >> bit;
+        for (size_t i = 0; i < bytes; ++i)
+            p[i] |= static_cast<unsigned char>(x >> (56 - 8 * i));
+    } else {
+        auto x = v >> (bit + n - 64);
+        for (size_t i = 0; i < 8; ++i)
+            p[i] |= static_cast<unsigned char>(x >> (56 - 8 * i));
+        p[8] |= static_cast<unsigned char>(v << (72 - bit - n));
+    }
+}
+} // namespace detail
+
+// A message layout described as a type: the fields of Msg in the order they
+// appear in the bits.
+//
+//     struct header { uint8_t version; uint8_t flags; uint16_t ext; };
+//     constexpr bool has_ext(const header &h) { return h.flags & 1; }
+//     using header_layout = ict::layout<header,
+//         ict::field<&header::version, 4>,
+//         ict::field<&header::flags, 4>,
+//         ict::optional_field<&header::ext, 16, has_ext>>;
+//
+// The offsets of the fields up to the first optional one are compile-time
+// constants.  When the bits start on a byte boundary those fields are read
+// with extract() and the rest with one read_bits() each.
+template <typename Msg, typename... Fields> class layout {
+    static_assert(sizeof...(Fields) > 0, "a layout needs fields");
+    static_assert(std::is_default_constructible<Msg>::value,
+                  "layout messages must be default constructible");
+
+    using fields = std::tuple<Fields...>;
+    template <size_t I> using field_at = std::tuple_element_t<I, fields>;
+
+    static constexpr size_t count = sizeof...(Fields);
+    static constexpr size_t widths[] = {Fields::width...};
+    static constexpr bool optionals[] = {Fields::optional...};
+    static constexpr size_t dynamic = ~size_t(0);
+
+    // The offset of field I, or dynamic if an optional field comes before it.
+    static constexpr size_t static_offset(size_t i) {
+        size_t off = 0;
+        for (size_t j = 0; j < i; ++j) {
+            if (optionals[j])
+                return dynamic;
+            off += widths[j];
+        }
+        return off;
+    }
+
+    // Bits taken by the fields from I on that are always there.
+    static constexpr size_t mandatory_from(size_t i) {
+        size_t n = 0;
+        for (; i < count; ++i)
+            if (!optionals[i])
+                n += widths[i];
+        return n;
+    }
+
+  public:
+    // The smallest encoding, with every optional field absent.
+    static constexpr size_t min_bits = mandatory_from(0);
+
+    // The largest encoding, with every optional field present.
+    static constexpr size_t max_bits = (Fields::width + ...);
+
+    // True when every message encodes to min_bits.
+    static constexpr bool fixed_size = !(Fields::optional || ...);
+
+    // The size of the encoding of m.
+    static size_t bit_size(const Msg &m) {
+        return ((Fields::present(m) ? Fields::width : 0) + ...);
+    }
+
+    // Decode a message from the start of bits.  It is an error for bits to be
+    // shorter than the message.
+    static Msg decode(const bitstring_view &bits) {
+        Msg m{};
+        decode(bits, m);
+        return m;
+    }
+
+    // Decode a message from a stream, which is advanced past it.
+    static Msg decode(ibitstream &is) {
+        Msg m{};
+        // A streaming source can find its end in the peek's refill, so only
+        // then is remaining() known.
+        auto bits = is.peek_view(std::min(is.remaining(), max_bits));
+        is.seek(decode(bits.substr(0, is.remaining()), m));
+        return m;
+    }
+
+    // Decode into m and return the number of bits read.
+    static size_t decode(const bitstring_view &bits, Msg &m) {
+        if (bits.bit_size() < min_bits)
+            IT_PANIC("layout needs " << min_bits << " bits, only "
+                                     << bits.bit_size() << " available");
+        if (bits.offset() % 8 == 0)
+            return decode_fields<0, true>(bits.data(), 0, bits.bit_size(), 0,
+                                          m);
+        return decode_fields<0, false>(bits.data(), bits.offset(),
+                                       bits.bit_size(), 0, m);
+    }
+
+    static bitstring encode(const Msg &m) {
+        bitstring bits(bit_size(m));
+        encode_fields<0>(bits.begin(), 0, m);
+        return bits;
+    }
+
+    static void encode(obitstream &os, const Msg &m) {
+        write_fields<0>(os, m);
+    }
+
+  private:
+    template <size_t I, bool Aligned>
+    static size_t decode_fields(const unsigned char *p, size_t base,
+                                size_t size, size_t off, Msg &m) {
+        if constexpr (I == count) {
+            return off;
+        } else {
+            using F = field_at<I>;
+            constexpr size_t w = F::width;
+            constexpr size_t so = static_offset(I);
+            if constexpr (so != dynamic)
+                off = so;
+            if constexpr (F::optional) {
+                if (!F::present(m))
+                    return decode_fields<I + 1, Aligned>(p, base, size, off,
+                                                         m);
+                // min_bits covered the fields that are always there
+                if (off + w + mandatory_from(I + 1) > size)
+                    IT_PANIC("layout field " << I << " at " << off
+                                             << " runs past " << size
+                                             << " bits");
+            }
+            if constexpr (!F::padding) {
+                using V = typename detail::member_of<
+                    std::remove_cv_t<decltype(F::member)>>::type;
+                static_assert(std::is_integral<V>::value ||
+                                  std::is_enum<V>::value,
+                              "layout fields must be integral or enum");
+                uint64_t x;
+                if constexpr (Aligned && so != dynamic)
+                    x = extract<so, w, uint64_t>(p);
+                else
+                    x = detail::read_bits(p, base + off, w);
+                m.*(F::member) = detail::from_field<V, w>(x);
+            }
+            return decode_fields<I + 1, Aligned>(p, base, size, off + w, m);
+        }
+    }
+
+    template <size_t I>
+    static void encode_fields(unsigned char *p, size_t off, const Msg &m) {
+        if constexpr (I < count) {
+            using F = field_at<I>;
+            constexpr size_t w = F::width;
+            constexpr size_t so = static_offset(I);
+            if constexpr (F::optional) {
+                if (!F::present(m))
+                    return encode_fields<I + 1>(p, off, m);
+            }
+            if constexpr (!F::padding) {
+                auto x = detail::to_field(m.*(F::member));
+                if constexpr (so != dynamic)
+                    insert<so, w>(p, x);
+                else
+                    detail::or_bits(p, off, x & detail::field_mask<w>(), w);
+            }
+            encode_fields<I + 1>(p, off + w, m);
+        }
+    }
+
+    template <size_t I> static void write_fields(obitstream &os, const Msg &m) {
+        if constexpr (I < count) {
+            using F = field_at<I>;
+            if (F::present(m)) {
+                if constexpr (F::padding) {
+                    for (size_t n = F::width; n; n -= std::min<size_t>(n, 64))
+                        os.write_bits(0, std::min<size_t>(n, 64));
+                } else {
+                    os.write_bits(detail::to_field(m.*(F::member)), F::width);
+                }
+            }
+            write_fields<I + 1>(os, m);
+        }
+    }
+};
+} // namespace ict
@@ -0,0 +1,117 @@
+#pragma once
+#include "ict.h"
+#include <fstream>
+#include <iterator>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define ICT_HAS_MMAP 1
+#endif
+
+namespace ict {
+// A whole file mapped read only into memory, so even a very large capture can
+// be decoded in place without reading it first:
+//
+//     ict::mapped_file capture("trace.bin");
+//     ict::ibitstream is(capture.data(), capture.bit_size());
+//
+// Pages are read in as they are touched.  Where there is no mmap the file is
+// read into memory instead.
+class mapped_file {
+  public:
+    explicit mapped_file(const std::string &filename) {
+#if defined(ICT_HAS_MMAP)
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            IT_PANIC("Can't open file \"" << filename
+                                           << "\": " << strerror(errno));
+        struct stat st;
+        if (::fstat(fd, &st) < 0) {
+            auto err = errno;
+            ::close(fd);
+            IT_PANIC("Can't stat file \"" << filename
+                                           << "\": " << strerror(err));
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_) {
+            auto p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            auto err = errno;
+            ::close(fd);
+            if (p == MAP_FAILED)
+                IT_PANIC("Can't map file \"" << filename
+                                              << "\": " << strerror(err));
+#if defined(MADV_SEQUENTIAL)
+            // captures are mostly decoded front to back
+            ::madvise(p, size_, MADV_SEQUENTIAL);
+#endif
+            data_ = static_cast<const unsigned char *>(p);
+        } else {
+            ::close(fd);
+        }
+#else
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+            IT_PANIC("Can't open file \"" << filename << "\"");
+        copy_.assign(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+        data_ = copy_.data();
+        size_ = copy_.size();
+#endif
+    }
+
+    mapped_file(mapped_file &&b) noexcept
+        : data_(b.data_), size_(b.size_)
+#if !defined(ICT_HAS_MMAP)
+          ,
+          copy_(std::move(b.copy_))
+#endif
+    {
+        b.data_ = nullptr;
+        b.size_ = 0;
+    }
+
+    mapped_file &operator=(mapped_file &&b) noexcept {
+        if (this != &b) {
+            unmap();
+            data_ = b.data_;
+            size_ = b.size_;
+#if !defined(ICT_HAS_MMAP)
+            copy_ = std::move(b.copy_);
+#endif
+            b.data_ = nullptr;
+            b.size_ = 0;
+        }
+        return *this;
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    ~mapped_file() { unmap(); }
+
+    const unsigned char *data() const { return data_; }
+    const unsigned char *begin() const { return data_; }
+    const unsigned char *end() const { return data_ + size_; }
+
+    // size in bytes
+    size_t size() const { return size_; }
+    size_t bit_size() const { return size_ * 8; }
+    bool empty() const { return size_ == 0; }
+
+  private:
+    void unmap() {
+#if defined(ICT_HAS_MMAP)
+        if (data_)
+            ::munmap(const_cast<unsigned char *>(data_), size_);
+#endif
+    }
+
+    const unsigned char *data_ = nullptr;
+    size_t size_ = 0;
+#if !defined(ICT_HAS_MMAP)
+    std::vector<unsigned char> copy_;
+#endif
+};
+} // namespace ict
@@ -1,6 +1,14 @@
+#include <bitpool.h>
 #include <bitstring.h>
 #include <command.h>
+#include <crc.h>
+#include <cstdio>
 #include <ict.h>
+#include <iomanip>
+#include <layout.h>
+#include <mapped_file.h>
+#include <thread>
+#include <unordered_map>
 
 using std::cerr;
 
@@ -36,6 +44,19 @@ static void in_bits(int s, int n) {
     });
 }
 
+static void in_uints(int s, int n) {
+    auto bits = ict::random_bitstring(1024);
+    uint64_t sum = 0;
+
+    time_op(n, [&]() {
+        ict::ibitstream ibs(bits);
+        while (!ibs.eobits())
+            sum += ibs.read_uint<uint32_t>(s);
+    });
+    if (sum == 42)
+        cerr << "lucky\n";
+}
+
 static void out_bits(int s, int n) {
     // create a giant bitstring
     auto bits = ict::random_bitstring(s);
@@ -44,9 +65,840 @@ static void out_bits(int s, int n) {
     time_op(n, [&]() { obs << bits; }, [&]() { auto x = obs.bits(); });
 }
 
+static void out_uints(int s, int n) {
+    ict::obitstream obs;
+    uint64_t v = 0x5A5A5A5A5A5A5A5A;
+    time_op(n, [&]() { obs.write_uint(v++, s); },
+            [&]() { auto x = obs.bits(); });
+}
+
+// Build a 4 KB message and finalize it by copying or by taking the buffer.
+static void out_message(bool take, int n) {
+    size_t total = 0;
+    cerr << (take ? "take_bits(): " : "bits():      ");
+    time_op(n, [&]() {
+        ict::obitstream obs;
+        for (uint32_t i = 0; i < 1024; ++i)
+            obs.write_uint(i, 32);
+        auto msg = take ? std::move(obs).take_bits() : obs.bits();
+        total += msg.bit_size();
+    });
+    if (total == 42)
+        cerr << "lucky\n";
+}
+
+// Decode shaped workload: split a message into mixed size fields, most of
+// which are too big to be stored inline.
+static void decode_fields(const ict::bitstring &msg,
+                          std::vector<ict::bitstring> &fields) {
+    static const size_t sizes[] = {3, 8, 72, 16, 128, 11, 200, 96, 1, 160};
+    ict::ibitstream ibs(msg);
+    for (size_t i = 0; !ibs.eobits(); ++i)
+        fields.push_back(ibs.read(sizes[i % 10]));
+}
+
+static void decode_global(int n) {
+    auto msg = ict::random_bitstring(4096);
+    size_t count = 0;
+    cerr << "global new: ";
+    time_op(n, [&]() {
+        std::vector<ict::bitstring> fields;
+        fields.reserve(64);
+        decode_fields(msg, fields);
+        count += fields.size();
+    });
+    if (count == 42)
+        cerr << "lucky\n";
+}
+
+#ifdef ICT_HAS_PMR
+static void decode_arena(int n) {
+    auto msg = ict::random_bitstring(4096);
+    size_t count = 0;
+    unsigned char buf[16 * 1024];
+    cerr << "arena:      ";
+    time_op(n, [&]() {
+        std::pmr::monotonic_buffer_resource arena(buf, sizeof(buf));
+        ict::bitstring_resource_scope scope(&arena);
+        std::vector<ict::bitstring> fields;
+        fields.reserve(64);
+        decode_fields(msg, fields);
+        count += fields.size();
+    });
+    if (count == 42)
+        cerr << "lucky\n";
+}
+#endif
+
+// Read fields drawn from a size distribution, which decides how many of them
+// fit inline.
+static void field_sizes(const char *name, std::vector<size_t> sizes, int n) {
+    auto msg = ict::random_bitstring(8192);
+    size_t count = 0;
+    cerr << std::left << std::setw(12) << name;
+    time_op(n, [&]() {
+        std::vector<ict::bitstring> fields;
+        fields.reserve(256);
+        ict::ibitstream ibs(msg);
+        for (size_t i = 0; !ibs.eobits(); ++i)
+            fields.push_back(ibs.read(sizes[i % sizes.size()]));
+        count += fields.size();
+    });
+    if (count == 42)
+        cerr << "lucky\n";
+}
+
+// Text to bitstring throughput in GB/s of input text.
+static void parse_text(const char *name, const std::string &text, int n) {
+    ict::timer time;
+    ict::bitstring bits;
+    time.start();
+    for (int i = 0; i < n; ++i)
+        ict::parse_bitstring(text.data(), text.data() + text.size(), bits);
+    time.stop();
+    auto bytes = static_cast<double>(text.size()) * n;
+    cerr << std::left << std::setw(16) << name << std::fixed
+         << std::setprecision(2) << bytes / time.nano() << " GB/s\n";
+}
+
+static void parse_texts() {
+    auto x = ict::random_bitstring(8 * 1024 * 1024);
+    auto hex = ict::to_string(x);
+    auto bin = "@" + ict::to_string(x.substr(0, 8 * 1024 * 1024 - 1)).substr(1);
+    std::string spaced = "#";
+    for (size_t i = 1; i < hex.size(); i += 2)
+        spaced.append(hex, i, 2).append(" ");
+    parse_text("hex", hex, 20);
+    parse_text("hex, spaced", spaced, 20);
+    parse_text("binary", bin, 5);
+}
+
+// Bitwise operator throughput in GB/s for s bit operands.
+template <typename Op>
+static void bitwise_op(const char *name, size_t s, int n, Op op) {
+    auto a = ict::random_bitstring(s);
+    auto b = ict::random_bitstring(s);
+    ict::timer time;
+    time.start();
+    for (int i = 0; i < n; ++i)
+        op(a, b);
+    time.stop();
+    auto bytes = static_cast<double>(s / 8) * n;
+    cerr << std::left << std::setw(12) << name << std::fixed
+         << std::setprecision(2) << bytes / time.nano() << " GB/s\n";
+}
+
+static void bitwise_ops(size_t s, int n) {
+    cerr << s << " bits\n";
+    bitwise_op("bit loop &", s, n / 64, [](auto &a, auto &b) {
+        for (size_t i = 0; i < a.bit_size(); ++i)
+            if (!b.at(i))
+                a.reset(i);
+    });
+    bitwise_op("&=", s, n, [](auto &a, auto &b) { a &= b; });
+    bitwise_op("^=", s, n, [](auto &a, auto &b) { a ^= b; });
+    bitwise_op("flip", s, n, [](auto &a, auto &) { a.flip(); });
+    bitwise_op("<<= 3", s, n, [](auto &a, auto &) { a <<= 3; });
+    bitwise_op(">>= 3", s, n, [](auto &a, auto &) { a >>= 3; });
+    bitwise_op("a | b", s, n, [](auto &a, auto &b) {
+        auto c = a | b;
+        a.set(c.bit_size() - 1);
+    });
+}
+
+// Walk the set bits of a 256 bit presence mask.
+static void presence_mask(int n) {
+    ict::bitstring mask(256);
+    for (size_t i = 3; i < 256; i += 17)
+        mask.set(i);
+    size_t sum = 0;
+    cerr << "at() loop:   ";
+    time_op(n, [&]() {
+        for (size_t i = 0; i < mask.bit_size(); ++i)
+            if (mask.at(i))
+                sum += i;
+    });
+    cerr << "find_next(): ";
+    time_op(n, [&]() {
+        for (auto i = mask.find_first(); i != mask.npos; i = mask.find_next(i))
+            sum += i;
+    });
+    cerr << "count():     ";
+    time_op(n, [&]() { sum += mask.count(); });
+    if (sum == 42)
+        cerr << "lucky\n";
+}
+
+// Find a 24 bit sync word at every bit offset in a capture, compared with
+// testing each offset in turn.
+static void sync_search(size_t bytes, int n) {
+    auto capture = ict::random_bitstring(bytes * 8);
+    ict::bitstring sync("#47A5C3");
+    for (size_t i = 1001; i + 24 < capture.bit_size(); i += 100003)
+        ict::bit_copy_n(sync.bit_begin(), 24, capture.bit_begin() + i);
+    size_t found = 0;
+    ict::timer time;
+    time.start();
+    for (int i = 0; i < n; ++i)
+        found += capture.find_all(sync).size();
+    time.stop();
+    cerr << "find_all() " << bytes << " bytes: " << std::fixed
+         << std::setprecision(2) << static_cast<double>(bytes) * n / time.nano()
+         << " GB/s, " << found / n << " matches\n";
+
+    ict::bitstring_view view(capture);
+    found = 0;
+    time.start();
+    for (size_t i = 0; i + 24 <= view.bit_size(); ++i)
+        if (view.substr(i, 24) == sync)
+            ++found;
+    time.stop();
+    cerr << "substr() loop " << bytes << " bytes: "
+         << std::setprecision(4) << static_cast<double>(bytes) / time.nano()
+         << " GB/s, " << found
+         << " matches\n";
+}
+
+// Scan a capture for a 32 bit preamble allowing k bit errors.
+static void near_search(size_t bytes, int n) {
+    auto capture = ict::random_bitstring(bytes * 8);
+    ict::bitstring preamble("#7E81A55A");
+    for (size_t k : {0, 1, 2, 4, 8}) {
+        size_t found = 0;
+        ict::timer time;
+        time.start();
+        for (int i = 0; i < n; ++i)
+            found += capture.find_all(preamble, k).size();
+        time.stop();
+        cerr << "find_all() k = " << k << ": " << std::fixed
+             << std::setprecision(2)
+             << static_cast<double>(bytes) * n / time.nano() << " GB/s, "
+             << found / n << " matches\n";
+    }
+}
+
+// CRC and checksum throughput on byte aligned and misaligned data.
+static void checksum_rates(size_t bytes, int n) {
+    auto data = ict::random_bitstring(bytes * 8 + 3);
+    auto aligned = ict::bitstring_view(data).substr(0, bytes * 8);
+    auto shifted = ict::bitstring_view(data).substr(3, bytes * 8);
+    uint64_t sum = 0;
+    auto rate = [&](const char *name, auto op) {
+        for (auto &v : {aligned, shifted}) {
+            ict::timer time;
+            time.start();
+            for (int i = 0; i < n; ++i)
+                sum += op(v);
+            time.stop();
+            cerr << name << (v.offset() ? " (offset 3): " : ": ")
+                 << std::fixed << std::setprecision(2)
+                 << static_cast<double>(bytes) * n / time.nano() << " GB/s\n";
+        }
+    };
+    ict::crc crc32(ict::crc32);
+    ict::crc crc16(ict::crc16_ibm_3740);
+    ict::crc crc24(ict::crc24_lte_a);
+    rate("crc32", [&](auto &v) { return crc32(v); });
+    rate("crc16", [&](auto &v) { return crc16(v); });
+    rate("crc24 lte a", [&](auto &v) { return crc24(v); });
+    rate("internet checksum",
+         [&](auto &v) { return ict::internet_checksum(v); });
+    rate("fletcher32", [&](auto &v) { return ict::fletcher32(v); });
+    if (sum == 42)
+        cerr << "lucky\n";
+}
+
+// GSM 7 bit SMS decoding and encoding, 160 character messages.
+static void sms_codec(int n) {
+    std::string text;
+    for (int i = 0; i < 160; ++i)
+        text += "Hello @ $1.50 world "[i % 20];
+    auto packed = ict::to_gsm7(text);
+    auto udh = ict::to_gsm7(text.substr(0, 153), 1);
+    char out[320];
+    unsigned char bytes[140];
+    size_t sum = 0;
+    auto rate = [&](const char *name, auto op) {
+        ict::timer time;
+        time.start();
+        for (int i = 0; i < n; ++i)
+            sum += op();
+        time.stop();
+        cerr << name << ": " << std::fixed << std::setprecision(2)
+             << 140.0 * n / time.nano() << " GB/s packed, "
+             << static_cast<double>(n) / time.nano() * 1e3
+             << " M messages/s\n";
+    };
+    rate("gsm7()         ", [&]() { return ict::gsm7(packed).size(); });
+    rate("gsm7_decode()  ", [&]() { return ict::gsm7_decode(packed, out); });
+    rate("gsm7_decode(1) ",
+         [&]() { return ict::gsm7_decode(udh, out, 1); });
+    rate("gsm7_encode()  ", [&]() {
+        return ict::gsm7_encode(text.data(), text.size(), bytes);
+    });
+    if (sum == 42)
+        cerr << "lucky\n";
+}
+
+// Packing text to 7 bits a character and back.
+static void ascii7_rates(size_t size, int n) {
+    std::string text;
+    for (size_t i = 0; i < size; ++i)
+        text += static_cast<char>(' ' + i % 95);
+    auto packed = ict::from_ascii7(text.data(), text.data() + size);
+    std::string out(size, ' ');
+    size_t sum = 0;
+    auto rate = [&](const char *name, auto op) {
+        ict::timer time;
+        time.start();
+        for (int i = 0; i < n; ++i)
+            sum += op();
+        time.stop();
+        cerr << name << size << " chars: " << std::fixed
+             << std::setprecision(2)
+             << static_cast<double>(size) * n / time.nano() << " GB/s\n";
+    };
+    rate("from_ascii7() ", [&]() {
+        return ict::from_ascii7(text.data(), text.data() + size).bit_size();
+    });
+    rate("to_ascii7()   ",
+         [&]() { return ict::to_ascii7(packed, &out[0]); });
+    if (sum == 42)
+        cerr << "lucky\n";
+}
+
+// Decoding the fixed part of an IPv4 header with a stream and with
+// compile-time field offsets.
+static void fixed_header(int n) {
+    const size_t count = 1024;
+    std::vector<unsigned char> headers(20 * count);
+    auto bits = ict::random_bitstring(headers.size() * 8);
+    std::copy(bits.begin(), bits.begin() + headers.size(), headers.begin());
+    std::vector<ict::bitstring> streams;
+    for (size_t h = 0; h < count; ++h)
+        streams.push_back(ict::bitstring(bits.bit_begin() + 160 * h, 160));
+    uint64_t sum = 0;
+    auto rate = [&](const char *name, auto op) {
+        ict::timer time;
+        time.start();
+        for (int i = 0; i < n; ++i)
+            for (size_t h = 0; h < count; ++h)
+                sum += op(h);
+        time.stop();
+        cerr << name << ": " << std::fixed << std::setprecision(2)
+             << static_cast<double>(count) * n / time.nano() * 1e3
+             << " M headers/s\n";
+    };
+    rate("ibitstream", [&](size_t h) {
+        ict::ibitstream is(streams[h]);
+        uint64_t s = is.read_uint(4);  // version
+        s += is.read_uint(4);          // ihl
+        s += is.read_uint(6);          // dscp
+        s += is.read_uint(2);          // ecn
+        s += is.read_uint(16);         // total length
+        s += is.read_uint(16);         // identification
+        s += is.read_uint(3);          // flags
+        s += is.read_uint(13);         // fragment offset
+        s += is.read_uint(8);          // ttl
+        s += is.read_uint(8);          // protocol
+        s += is.read_uint(16);         // checksum
+        s += is.read_uint(32);         // source
+        return s + is.read_uint(32);   // destination
+    });
+    rate("extract   ", [&](size_t h) {
+        auto p = &headers[20 * h];
+        uint64_t s = ict::extract<0, 4>(p);
+        s += ict::extract<4, 4>(p);
+        s += ict::extract<8, 6>(p);
+        s += ict::extract<14, 2>(p);
+        s += ict::extract<16, 16>(p);
+        s += ict::extract<32, 16>(p);
+        s += ict::extract<48, 3>(p);
+        s += ict::extract<51, 13>(p);
+        s += ict::extract<64, 8>(p);
+        s += ict::extract<72, 8>(p);
+        s += ict::extract<80, 16>(p);
+        s += ict::extract<96, 32>(p);
+        return s + ict::extract<128, 32>(p);
+    });
+    if (sum == 42)
+        cerr << "lucky\n";
+}
+
+// Hashing bits directly, against the hex string keys used before.
+static void hash_rates(size_t bytes, int n) {
+    auto bits = ict::random_bitstring(bytes * 8 + 8);
+    auto aligned = ict::bitstring_view(bits).substr(0, bytes * 8);
+    auto misaligned = ict::bitstring_view(bits).substr(3, bytes * 8);
+    uint64_t sum = 0;
+    auto rate = [&](const char *name, auto op) {
+        ict::timer time;
+        time.start();
+        for (int i = 0; i < n; ++i)
+            sum += op(static_cast<uint64_t>(i));
+        time.stop();
+        cerr << name << bytes << " bytes: " << std::fixed
+             << std::setprecision(2)
+             << static_cast<double>(bytes) * n / time.nano() << " GB/s\n";
+    };
+    // the seed changes so the hash isn't hoisted out of the loop
+    rate("hash()             ",
+         [&](uint64_t seed) { return ict::hash(aligned, seed); });
+    rate("hash() misaligned  ",
+         [&](uint64_t seed) { return ict::hash(misaligned, seed); });
+    rate("hash<std::string>  ", [&](uint64_t) {
+        return std::hash<std::string>()(ict::to_string(aligned));
+    });
+    if (sum == 42)
+        cerr << "lucky\n";
+}
+
+// Caching by raw message: a hit rate on bitstring keys against hex strings.
+static void message_cache(int n) {
+    std::vector<ict::bitstring> messages;
+    for (int i = 0; i < 4096; ++i)
+        messages.push_back(ict::random_bitstring(8 * (20 + i % 100)));
+    std::unordered_map<ict::bitstring, size_t> by_bits;
+    std::unordered_map<std::string, size_t> by_hex;
+    for (size_t i = 0; i < messages.size(); ++i) {
+        by_bits[messages[i]] = i;
+        by_hex[ict::to_string(messages[i])] = i;
+    }
+    size_t sum = 0;
+    auto rate = [&](const char *name, auto op) {
+        ict::timer time;
+        time.start();
+        for (int i = 0; i < n; ++i)
+            for (auto &m : messages)
+                sum += op(m);
+        time.stop();
+        cerr << name << ": " << std::fixed << std::setprecision(2)
+             << static_cast<double>(messages.size()) * n / time.nano() * 1e3
+             << " M lookups/s\n";
+    };
+    rate("bitstring keys ", [&](const ict::bitstring &m) {
+        return by_bits.find(m)->second;
+    });
+    rate("hex string keys", [&](const ict::bitstring &m) {
+        return by_hex.find(ict::to_string(m))->second;
+    });
+    if (sum == 42)
+        cerr << "lucky\n";
+}
+
+// One ibitstream per short message, decoded with constraints and marks nested
+// depth deep, as a TLV decoder would.
+static void short_streams(size_t depth, int n) {
+    auto msg = ict::random_bitstring(64 * 8);
+    uint64_t sum = 0;
+    ict::timer time;
+    time.start();
+    for (int i = 0; i < n; ++i) {
+        ict::ibitstream is(msg);
+        for (size_t level = 0; level < depth; ++level) {
+            is.constrain(is.remaining() - 16);
+            is.mark();
+            sum += is.read_uint(16) + is.last_mark();
+        }
+        while (is.remaining() >= 32)
+            sum += is.read_uint(32);
+        for (size_t level = 0; level < depth; ++level) {
+            is.unmark();
+            is.unconstrain();
+        }
+    }
+    time.stop();
+    cerr << "depth " << depth << ": " << std::fixed << std::setprecision(1)
+         << n / (time.nano() / 1e3) << " M streams/s\n";
+    if (sum == 42)
+        cerr << "lucky\n";
+}
+
+// A decoder trying one message format and falling back to another, by
+// building a new ibitstream at the message for the second try and by
+// rewinding to a checkpoint, which also works on a stream that can't be
+// rebuilt.
+static void backtracking(int n) {
+    const size_t count = 1000, size = 64 * 8;
+    ict::obitstream os;
+    for (size_t i = 0; i < count; ++i) {
+        os.write_bits(i, 32);
+        os.write_bits(i % 2 ? 0xA5 : 0x5A, 8);
+        for (size_t j = 40; j < size; j += 8)
+            os.write_bits(i + j, 8);
+    }
+    auto capture = os.bits();
+    // format a has the tag after a sequence number, b has it up front
+    auto try_a = [](ict::ibitstream &is, uint64_t &sum) {
+        ict::constraint c(is, size);
+        sum += is.read_uint(32);
+        if (is.read_uint(8) != 0xA5)
+            return false;
+        while (!is.eobits())
+            sum += is.read_uint(59);
+        return true;
+    };
+    auto try_b = [](ict::ibitstream &is, uint64_t &sum) {
+        ict::constraint c(is, size);
+        sum += is.read_uint(8);
+        while (!is.eobits())
+            sum += is.read_uint(43);
+        return true;
+    };
+    uint64_t a = 0, b = 0, c = 0;
+    size_t held = 0;
+    ict::timer rebuild, rewind, streamed;
+    rebuild.start();
+    for (int k = 0; k < n; ++k) {
+        ict::ibitstream is(capture);
+        while (!is.eobits()) {
+            auto off = is.tellg();
+            if (!try_a(is, a)) {
+                // start over from the original bits
+                ict::ibitstream again(capture);
+                again.seek(off);
+                try_b(again, a);
+                is.seek(off + size - is.tellg());
+            }
+        }
+    }
+    rebuild.stop();
+    rewind.start();
+    for (int k = 0; k < n; ++k) {
+        ict::ibitstream is(capture);
+        while (!is.eobits()) {
+            auto cp = is.checkpoint();
+            if (!try_a(is, b)) {
+                is.rewind(cp);
+                try_b(is, b);
+            }
+            is.commit(cp);
+        }
+    }
+    rewind.stop();
+    streamed.start();
+    for (int k = 0; k < n; ++k) {
+        size_t pos = 0;
+        ict::ibitstream is(
+            [&](unsigned char *p, size_t len) {
+                len = std::min<size_t>({len, 1500, capture.byte_size() - pos});
+                std::copy_n(capture.begin() + pos, len, p);
+                pos += len;
+                return len;
+            },
+            1500);
+        while (!is.eobits()) {
+            auto cp = is.checkpoint();
+            if (!try_a(is, c)) {
+                is.rewind(cp);
+                try_b(is, c);
+            }
+            is.commit(cp);
+        }
+        held = is.buffer_size();
+    }
+    streamed.stop();
+    auto rate = [&](ict::timer &t) {
+        return static_cast<double>(count) * n / (t.nano() / 1e3);
+    };
+    cerr << "rebuild: " << std::fixed << std::setprecision(1) << rate(rebuild)
+         << " M messages/s, rewind: " << rate(rewind)
+         << " M messages/s, rewind streamed: " << rate(streamed)
+         << " M messages/s holding " << held << " bytes\n";
+    if (a != b || a != c)
+        cerr << "mismatch\n";
+}
+
+// A feed of messages drawn from a few distinct payloads, kept as copies and
+// interned, on one thread and on several.
+static void interning(size_t distinct, size_t messages) {
+    std::vector<ict::bitstring> payloads;
+    for (size_t i = 0; i < distinct; ++i)
+        payloads.push_back(ict::random_bitstring(8 * (24 + i % 200)));
+    std::vector<size_t> feed(messages);
+    std::mt19937 engine(7);
+    for (auto &f : feed)
+        f = engine() % distinct;
+
+    ict::timer time;
+    time.start();
+    std::vector<ict::bitstring> copies;
+    size_t copy_bytes = 0;
+    for (auto f : feed) {
+        copies.push_back(payloads[f]);
+        copy_bytes += payloads[f].byte_size();
+    }
+    time.stop();
+    cerr << "copies  : " << std::fixed << std::setprecision(2)
+         << static_cast<double>(messages) / time.nano() * 1e3 << " M/s, "
+         << copy_bytes / 1024 << " KiB of bits\n";
+
+    for (unsigned threads : {1u, 4u}) {
+        ict::bitpool pool;
+        std::vector<std::vector<ict::bitpool::handle>> held(threads);
+        time.start();
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (size_t i = t; i < feed.size(); i += threads)
+                    held[t].push_back(pool.intern(payloads[feed[i]]));
+            });
+        }
+        for (auto &w : workers)
+            w.join();
+        time.stop();
+        auto st = pool.stats();
+        cerr << "interned: " << threads << " threads " << std::fixed
+             << std::setprecision(2)
+             << static_cast<double>(messages) / time.nano() * 1e3 << " M/s, "
+             << st.bytes / 1024 << " KiB of bits, hit rate "
+             << std::setprecision(4) << st.hit_rate() << '\n';
+    }
+}
+
+// Decoding a capture file read into a bitstring, against mapping it and
+// streaming from the mapping.
+static void capture_file(size_t bytes) {
+    const std::string name = "ictperf_capture.bin";
+    auto bits = ict::random_bitstring(bytes * 8);
+    ict::write_file(bits.data(), bits.data() + bits.byte_size(), name);
+    auto decode = [](ict::ibitstream &is) {
+        uint64_t sum = 0;
+        while (is.remaining() >= 32)
+            sum += is.read_uint(32);
+        return sum;
+    };
+    auto report = [&](const char *name, ict::timer &startup,
+                      ict::timer &total) {
+        cerr << name << ": ready in " << std::fixed << std::setprecision(2)
+             << startup.nano() / 1e6 << " ms, decoded at "
+             << static_cast<double>(bytes) / total.nano() << " GB/s\n";
+    };
+    uint64_t a, b;
+    {
+        ict::timer startup, total;
+        startup.start();
+        total.start();
+        auto contents = ict::read_file(name);
+        ict::bitstring copy(ict::bit_iterator(contents.data()),
+                            contents.size() * 8);
+        ict::ibitstream is(copy);
+        startup.stop();
+        a = decode(is);
+        total.stop();
+        report("read_file  ", startup, total);
+    }
+    {
+        ict::timer startup, total;
+        startup.start();
+        total.start();
+        ict::mapped_file file(name);
+        ict::ibitstream is(file.data(), file.bit_size());
+        startup.stop();
+        b = decode(is);
+        total.stop();
+        report("mapped_file", startup, total);
+    }
+    std::remove(name.c_str());
+    if (a != b)
+        cerr << "mismatch\n";
+}
+
+// A capture of length prefixed messages decoded from a source handing over
+// chunk sized pieces, like a socket or pipe, against reading it all first.
+static void stream_capture(size_t bytes, size_t chunk) {
+    ict::obitstream os;
+    uint32_t seed = 1;
+    size_t messages = 0;
+    while (os.bit_size() / 8 < bytes) {
+        seed = seed * 1103515245 + 12345;
+        size_t len = 20 + (seed >> 16) % 1480;
+        os.write_bits(len, 16);
+        for (size_t i = 0; i < len; ++i)
+            os.write_bits(i ^ seed, 8);
+        ++messages;
+    }
+    auto capture = os.bits();
+    auto decode = [](ict::ibitstream &is) {
+        uint64_t sum = 0;
+        while (!is.eobits()) {
+            auto len = is.read_uint(16);
+            ict::constraint message(is, len * 8);
+            while (is.remaining() >= 32)
+                sum += is.read_uint(32);
+            sum += is.read_uint(is.remaining());
+        }
+        return sum;
+    };
+    auto source = [&](size_t &pos) {
+        return [&capture, &pos, chunk](unsigned char *p, size_t n) {
+            n = std::min({n, chunk, capture.byte_size() - pos});
+            std::copy_n(capture.begin() + pos, n, p);
+            pos += n;
+            return n;
+        };
+    };
+    uint64_t a, b;
+    size_t held;
+    ict::timer whole, streamed;
+    {
+        size_t pos = 0;
+        whole.start();
+        // everything buffered before decoding starts
+        std::vector<unsigned char> all(capture.byte_size());
+        auto read = source(pos);
+        while (read(all.data() + pos, all.size() - pos))
+            ;
+        ict::ibitstream is(all.data(), capture.bit_size());
+        a = decode(is);
+        whole.stop();
+    }
+    {
+        size_t pos = 0;
+        streamed.start();
+        ict::ibitstream is(source(pos), chunk);
+        b = decode(is);
+        streamed.stop();
+        held = is.buffer_size();
+    }
+    cerr << messages << " messages in " << chunk << " byte chunks: whole "
+         << std::fixed << std::setprecision(2)
+         << static_cast<double>(capture.byte_size()) / whole.nano()
+         << " GB/s holding " << capture.byte_size() / 1024
+         << " KB, streamed "
+         << static_cast<double>(capture.byte_size()) / streamed.nano()
+         << " GB/s holding " << held / 1024.0 << " KB\n";
+    if (a != b)
+        cerr << "mismatch\n";
+}
+
+struct ipv4_header {
+    uint8_t version, ihl, dscp, ecn;
+    uint16_t length, id;
+    uint8_t flags;
+    uint16_t fragment;
+    uint8_t ttl, protocol;
+    uint16_t checksum;
+    uint32_t source, destination;
+};
+
+using ipv4_layout = ict::layout<
+    ipv4_header, ict::field<&ipv4_header::version, 4>,
+    ict::field<&ipv4_header::ihl, 4>, ict::field<&ipv4_header::dscp, 6>,
+    ict::field<&ipv4_header::ecn, 2>, ict::field<&ipv4_header::length, 16>,
+    ict::field<&ipv4_header::id, 16>, ict::field<&ipv4_header::flags, 3>,
+    ict::field<&ipv4_header::fragment, 13>, ict::field<&ipv4_header::ttl, 8>,
+    ict::field<&ipv4_header::protocol, 8>,
+    ict::field<&ipv4_header::checksum, 16>,
+    ict::field<&ipv4_header::source, 32>,
+    ict::field<&ipv4_header::destination, 32>>;
+
+// Decoding IPv4 headers into a struct with a chain of stream reads and with
+// a layout, and encoding them back.
+static void message_layout(int n) {
+    const size_t count = 1024;
+    auto bits = ict::random_bitstring(160 * count);
+    std::vector<ict::bitstring> headers;
+    for (size_t h = 0; h < count; ++h)
+        headers.push_back(ict::bitstring(bits.bit_begin() + 160 * h, 160));
+    std::vector<ipv4_header> decoded(count);
+    uint64_t sum = 0;
+    auto rate = [&](const char *name, auto op) {
+        ict::timer time;
+        time.start();
+        for (int i = 0; i < n; ++i)
+            for (size_t h = 0; h < count; ++h)
+                op(h);
+        time.stop();
+        cerr << name << ": " << std::fixed << std::setprecision(2)
+             << static_cast<double>(count) * n / time.nano() * 1e3
+             << " M headers/s\n";
+    };
+    rate("ibitstream decode", [&](size_t h) {
+        ict::ibitstream is(headers[h]);
+        auto &d = decoded[h];
+        d.version = is.read_uint<uint8_t>(4);
+        d.ihl = is.read_uint<uint8_t>(4);
+        d.dscp = is.read_uint<uint8_t>(6);
+        d.ecn = is.read_uint<uint8_t>(2);
+        d.length = is.read_uint<uint16_t>(16);
+        d.id = is.read_uint<uint16_t>(16);
+        d.flags = is.read_uint<uint8_t>(3);
+        d.fragment = is.read_uint<uint16_t>(13);
+        d.ttl = is.read_uint<uint8_t>(8);
+        d.protocol = is.read_uint<uint8_t>(8);
+        d.checksum = is.read_uint<uint16_t>(16);
+        d.source = is.read_uint<uint32_t>(32);
+        d.destination = is.read_uint<uint32_t>(32);
+        sum += d.ttl;
+    });
+    rate("layout decode    ", [&](size_t h) {
+        decoded[h] = ipv4_layout::decode(headers[h]);
+        sum += decoded[h].ttl;
+    });
+    rate("obitstream encode", [&](size_t h) {
+        auto &d = decoded[h];
+        ict::obitstream os;
+        os.write_bits(d.version, 4).write_bits(d.ihl, 4);
+        os.write_bits(d.dscp, 6).write_bits(d.ecn, 2);
+        os.write_bits(d.length, 16).write_bits(d.id, 16);
+        os.write_bits(d.flags, 3).write_bits(d.fragment, 13);
+        os.write_bits(d.ttl, 8).write_bits(d.protocol, 8);
+        os.write_bits(d.checksum, 16).write_bits(d.source, 32);
+        os.write_bits(d.destination, 32);
+        sum += os.bit_size();
+    });
+    rate("layout encode    ", [&](size_t h) {
+        sum += ipv4_layout::encode(decoded[h]).bit_size();
+    });
+    if (sum == 42)
+        cerr << "lucky\n";
+}
+
+// Report bit_copy_n() throughput for every source/destination bit offset.
+static void copy_bits(size_t s, int n) {
+    auto src = ict::random_bitstring(s + 8);
+    auto dst = ict::bitstring(s + 8);
+
+    cerr << "bit_copy_n " << s << " bits, GB/s (rows: src offset, columns: "
+            "dst offset)\n";
+    for (size_t so = 0; so < 8; ++so) {
+        for (size_t d = 0; d < 8; ++d) {
+            ict::timer time;
+            time.start();
+            for (int i = 0; i < n; ++i)
+                ict::bit_copy_n(src.bit_begin() + so, s, dst.bit_begin() + d);
+            time.stop();
+            auto bytes = static_cast<double>(s / 8) * n;
+            cerr << ' ' << std::fixed << std::setprecision(2)
+                 << bytes / time.nano();
+        }
+        cerr << '\n';
+    }
+}
+
 int main(int argc, char **argv) {
     bool input = false;
     bool output = false;
+    bool copy = false;
+    bool arena = false;
+    bool fields = false;
+    bool parse = false;
+    bool bitwise = false;
+    bool scan = false;
+    bool search = false;
+    bool near = false;
+    bool checksum = false;
+    bool sms = false;
+    bool ascii = false;
+    bool fixed = false;
+    bool messages = false;
+    bool hashing = false;
+    bool intern = false;
+    bool mapped = false;
+    bool stream = false;
+    bool streams = false;
+    bool backtrack = false;
     try {
         ict::command line("ictperf", "ict performance tests",
                           "ictperf [options]");
@@ -54,6 +906,44 @@ int main(int argc, char **argv) {
                              [&] { input = true; }));
         line.add(ict::option("obits", 'o', "output bitstream",
                              [&] { output = true; }));
+        line.add(ict::option("copy", 'c', "bit copy throughput",
+                             [&] { copy = true; }));
+        line.add(ict::option("arena", 'a', "arena versus global allocation",
+                             [&] { arena = true; }));
+        line.add(ict::option("fields", 'f', "field size distributions",
+                             [&] { fields = true; }));
+        line.add(ict::option("parse", 'p', "hex and binary text parsing",
+                             [&] { parse = true; }));
+        line.add(ict::option("bitwise", 'w', "bitwise operators and shifts",
+                             [&] { bitwise = true; }));
+        line.add(ict::option("scan", 's', "popcount and bit scans",
+                             [&] { scan = true; }));
+        line.add(ict::option("search", 'S', "bit pattern search",
+                             [&] { search = true; }));
+        line.add(ict::option("near", 'n', "bit error tolerant search",
+                             [&] { near = true; }));
+        line.add(ict::option("crc", 'r', "crc and checksum throughput",
+                             [&] { checksum = true; }));
+        line.add(ict::option("gsm7", 'g', "gsm 7 bit sms codec",
+                             [&] { sms = true; }));
+        line.add(ict::option("ascii7", '7', "7 bit ascii packing",
+                             [&] { ascii = true; }));
+        line.add(ict::option("extract", 'x', "compile-time field extraction",
+                             [&] { fixed = true; }));
+        line.add(ict::option("layout", 'l', "declarative message layouts",
+                             [&] { messages = true; }));
+        line.add(ict::option("hash", 'H', "hashing and message caches",
+                             [&] { hashing = true; }));
+        line.add(ict::option("intern", 'I', "bitstring interning pool",
+                             [&] { intern = true; }));
+        line.add(ict::option("mapped", 'm', "decoding a mapped capture file",
+                             [&] { mapped = true; }));
+        line.add(ict::option("stream", 'T', "decoding a refilled stream",
+                             [&] { stream = true; }));
+        line.add(ict::option("short", 'B', "building many short streams",
+                             [&] { streams = true; }));
+        line.add(ict::option("rewind", 'R', "backtracking with checkpoints",
+                             [&] { backtrack = true; }));
 
         line.parse(argc, argv);
         if (input) {
@@ -61,6 +951,10 @@ int main(int argc, char **argv) {
             in_bits(5, 100000);
             in_bits(8, 100000);
             in_bits(11, 100000);
+            in_uints(3, 100000);
+            in_uints(5, 100000);
+            in_uints(8, 100000);
+            in_uints(11, 100000);
         }
 
         if (output) {
@@ -68,7 +962,95 @@ int main(int argc, char **argv) {
             out_bits(5, 10000000);
             out_bits(8, 10000000);
             out_bits(11, 10000000);
+            out_uints(3, 10000000);
+            out_uints(5, 10000000);
+            out_uints(8, 10000000);
+            out_uints(11, 10000000);
+            out_message(false, 100000);
+            out_message(true, 100000);
+        }
+
+        if (copy) {
+            copy_bits(64, 1000000);
+            copy_bits(8 * 1024, 100000);
+        }
+
+        if (arena) {
+            decode_global(100000);
+#ifdef ICT_HAS_PMR
+            decode_arena(100000);
+#endif
+        }
+
+        if (fields) {
+            cerr << "sizeof(bitstring) = " << sizeof(ict::bitstring)
+                 << ", inline bits = " << ict::bitstring::local_bits << '\n';
+            field_sizes("small", {3, 8, 16, 32, 64}, 20000);
+            field_sizes("72-128", {72, 80, 96, 120, 128}, 20000);
+            field_sizes("mixed", {8, 72, 16, 128, 1, 96, 300}, 20000);
+            field_sizes("large", {200, 256, 512}, 20000);
+        }
+
+        if (parse)
+            parse_texts();
+
+        if (bitwise) {
+            bitwise_ops(8 * 1024, 100000);
+            bitwise_ops(8 * 1024 * 1024, 100);
+        }
+
+        if (scan)
+            presence_mask(1000000);
+
+        if (search)
+            sync_search(4 * 1024 * 1024, 20);
+
+        if (near)
+            near_search(4 * 1024 * 1024, 10);
+
+        if (checksum)
+            checksum_rates(1024 * 1024, 100);
+
+        if (sms)
+            sms_codec(1000000);
+
+        if (ascii) {
+            ascii7_rates(160, 1000000);
+            ascii7_rates(1024 * 1024, 200);
+        }
+
+        if (fixed)
+            fixed_header(2000);
+
+        if (messages)
+            message_layout(1000);
+
+        if (hashing) {
+            hash_rates(64, 10000000);
+            hash_rates(1024, 1000000);
+            hash_rates(1024 * 1024, 1000);
+            message_cache(200);
+        }
+
+        if (intern)
+            interning(1000, 2000000);
+
+        if (mapped)
+            capture_file(256 * 1024 * 1024);
+
+        if (stream) {
+            stream_capture(64 * 1024 * 1024, 1500);
+            stream_capture(64 * 1024 * 1024, 64 * 1024);
         }
+
+        if (streams) {
+            short_streams(1, 2000000);
+            short_streams(8, 2000000);
+            short_streams(20, 1000000);
+        }
+
+        if (backtrack)
+            backtracking(2000);
     } catch (std::exception &e) {
         cerr << "exception: " << e.what() << '\n';
     }
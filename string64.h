@@ -2,6 +2,7 @@
 #include "ict.h"
 #include <cstdint>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <map>
 
@@ -78,3 +79,16 @@ inline std::ostream &operator<<(std::ostream &os, const ict::string64 &x) {
 }
 typedef std::vector<ict::string64> string64_list;
 } // namespace ict
+
+namespace std {
+// The characters are already packed into a word, so finishing it with the
+// murmur3 mixer is enough.
+template <> struct hash<ict::string64> {
+    size_t operator()(const ict::string64 &s) const {
+        auto x = s.value;
+        x = (x ^ (x >> 33)) * 0xff51afd7ed558ccd;
+        x = (x ^ (x >> 33)) * 0xc4ceb9fe1a85ec53;
+        return static_cast<size_t>(x ^ (x >> 33));
+    }
+};
+} // namespace std
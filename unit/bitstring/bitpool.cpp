@@ -0,0 +1,108 @@
+#include "bitstringunit.h"
+#include <bitpool.h>
+#include <thread>
+#include <vector>
+
+void ict::bitstring_unit::interning() {
+    ict::bitpool pool;
+    auto data = ict::random_bitstring(1000);
+    auto a = pool.intern(ict::bitstring_view(data).substr(5, 300));
+    IT_ASSERT(*a == ict::bitstring_view(data).substr(5, 300));
+    IT_ASSERT(a->resource() == nullptr);
+
+    // the same bits from anywhere give the same payload
+    auto copy = ict::bitstring_view(data).substr(5, 300).bits();
+    IT_ASSERT(pool.intern(copy) == a);
+    IT_ASSERT(pool.intern(std::move(copy)) == a);
+    IT_ASSERT(pool.find(ict::bitstring_view(data).substr(5, 300)) == a);
+
+    // a prefix, a different length and different bits are all new
+    auto b = pool.intern(ict::bitstring_view(data).substr(5, 299));
+    auto c = pool.intern(ict::bitstring_view(data).substr(5, 301));
+    auto d = pool.intern(ict::bitstring_view(data).substr(6, 300));
+    IT_ASSERT(b != a && c != a && d != a && b != c);
+    IT_ASSERT(pool.intern(ict::bitstring()) == pool.intern(ict::bitstring()));
+    IT_ASSERT(pool.size() == 5);
+    IT_ASSERT(!pool.find(ict::bitstring("#DEADBEEF")));
+
+    // an owning bitstring is taken over when it's new
+    auto owned = ict::random_bitstring(ict::bitstring::local_bits + 64);
+    auto storage = owned.begin();
+    auto e = pool.intern(std::move(owned));
+    IT_ASSERT(e->begin() == storage);
+
+    auto st = pool.stats();
+    IT_ASSERT(st.lookups == 9);
+    IT_ASSERT(st.hits == 3);
+    IT_ASSERT(st.payloads == 6);
+    IT_ASSERT(st.bytes == 38 + 38 + 38 + 38 + 0 + e->byte_size());
+    IT_ASSERT(st.hit_rate() == 3.0 / 9);
+
+    // only what nobody else holds is released
+    b.reset();
+    c.reset();
+    IT_ASSERT(pool.release_unused() == 3); // b, c and the empty one
+    IT_ASSERT(pool.size() == 3);
+    IT_ASSERT(pool.find(ict::bitstring_view(data).substr(5, 300)) == a);
+    IT_ASSERT(pool.stats().bytes == 38 + 38 + e->byte_size());
+
+#ifdef ICT_HAS_PMR
+    {
+        // payloads outlive an arena the caller is using
+        unsigned char buf[4096];
+        std::pmr::monotonic_buffer_resource arena(buf, sizeof(buf));
+        ict::bitstring_resource_scope scope(&arena);
+        auto big = ict::random_bitstring(ict::bitstring::local_bits + 72);
+        IT_ASSERT(big.resource() == &arena);
+        IT_ASSERT(pool.intern(big)->resource() == nullptr);
+        IT_ASSERT(pool.intern(std::move(big))->resource() == nullptr);
+    }
+#endif
+
+    pool.clear();
+    IT_ASSERT(pool.size() == 0);
+    IT_ASSERT(*a == ict::bitstring_view(data).substr(5, 300));
+
+    // many threads interning the same few messages
+    ict::bitpool shared(4);
+    std::vector<ict::bitstring> messages;
+    for (int i = 0; i < 100; ++i)
+        messages.push_back(ict::random_bitstring(64 + 8 * i));
+    std::vector<std::vector<ict::bitpool::handle>> seen(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 50; ++round)
+                for (size_t i = 0; i < messages.size(); ++i) {
+                    auto &m = messages[(i * 7 + t * 13 + round) % 100];
+                    auto p = shared.intern(ict::bitstring_view(m));
+                    if (round == 49)
+                        seen[t].push_back(p);
+                }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    IT_ASSERT(shared.size() == 100);
+    auto sst = shared.stats();
+    IT_ASSERT(sst.lookups == 4 * 50 * 100);
+    IT_ASSERT(sst.hits == 4 * 50 * 100 - 100);
+    for (auto &m : messages) {
+        auto p = shared.find(m);
+        IT_ASSERT(p && *p == m);
+        size_t holders = 0;
+        for (auto &s : seen)
+            for (auto &q : s)
+                holders += q == p;
+        IT_ASSERT(holders == 4);
+    }
+
+    IT_ASSERT_MSG("no shards", [&]() {
+        try {
+            ict::bitpool empty(0);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+}
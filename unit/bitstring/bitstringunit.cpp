@@ -1,8 +1,11 @@
 #include "bitstringunit.h"
 #include <algorithm>
+#include <cctype>
 #include <bitstring.h>
 #include <cstdint>
 #include <cstring>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace ict {
@@ -13,8 +16,11 @@ struct store_init {
 };
 
 void bitstring_unit::bitstring_sanity() {
-    const size_t ptr_bytes = sizeof(char *);
-    const size_t ptr_bits = ptr_bytes * 8;
+    const size_t local_bits = ict::bitstring::local_bits;
+    const size_t local_bytes = local_bits / 8;
+
+    // inline bits share space with the heap pointer
+    IT_ASSERT(sizeof(ict::bitstring) == sizeof(size_t) + local_bytes);
 
     std::vector<store_init> init = {
         {0, 0, true},
@@ -31,9 +37,9 @@ void bitstring_unit::bitstring_sanity() {
         {16, 2, true},
         {17, 3, true},
 
-        {ptr_bits - 1, ptr_bytes, true},
-        {ptr_bits, ptr_bytes, true},
-        {ptr_bits + 1, ptr_bytes + 1, false},
+        {local_bits - 1, local_bytes, true},
+        {local_bits, local_bytes, true},
+        {local_bits + 1, local_bytes + 1, false},
         {8 * 1024 - 1, 1024, false},
         {8 * 1024, 1024, false},
         {8 * 1024 + 1, 1025, false},
@@ -364,6 +370,27 @@ void bitstring_unit::int_convert() {
         ict::bitstring v8 = ict::from_integer<unsigned>(8, 3);
         IT_ASSERT(ict::to_integer<unsigned>(v8) == 0);
     }
+    {
+        // a view converts the same as a bitstring of its bits
+        auto bits = ict::random_bitstring(80);
+        auto same = [&](auto type, size_t off, size_t len, bool swap) {
+            using T = decltype(type);
+            auto v = ict::bitstring_view(bits).substr(off, len);
+            return ict::to_integer<T>(v, swap) ==
+                   ict::to_integer<T>(v.bits(), swap);
+        };
+        for (size_t len = 1; len <= 72; ++len)
+            for (size_t off : {0, 3})
+                for (bool swap : {true, false}) {
+                    IT_ASSERT_MSG(len, same(uint8_t(), off, len, swap));
+                    IT_ASSERT_MSG(len, same(uint16_t(), off, len, swap));
+                    IT_ASSERT_MSG(len, same(uint32_t(), off, len, swap));
+                    IT_ASSERT_MSG(len, same(uint64_t(), off, len, swap));
+                }
+        ict::bitstring b24("#ABCDEF");
+        IT_ASSERT(ict::to_integer<uint32_t>(ict::bitstring_view(b24), false) ==
+                  ict::to_integer<uint32_t>(b24, false));
+    }
 }
 
 void bitstring_unit::modern_pad() {
@@ -591,6 +618,613 @@ void bitstring_unit::modern_gsm7() {
     }
 }
 
+void bitstring_unit::gsm7_codec() {
+    IT_ASSERT(ict::to_gsm7("Hello") == ict::bitstring("C8329BFD06"));
+    IT_ASSERT(ict::to_gsm7("12345678") == ict::bitstring("31D98C56B3DD70"));
+    IT_ASSERT(ict::to_gsm7("$@") == ict::bitstring("0200"));
+    IT_ASSERT(ict::to_gsm7("").empty());
+
+    // the UDH message from modern_gsm7, one fill bit
+    ict::bitstring raw(
+        "@11110000111110101111000010011100110111000111011010001011111011010"
+        "11000111011110000111110001111000010011100000011");
+    IT_ASSERT(ict::to_gsm7("xzasdmnbvcxzasd", 1) == raw);
+
+    char out[32];
+    IT_ASSERT(ict::gsm7_size(raw.bit_size(), 1) == 30);
+    IT_ASSERT(ict::gsm7_decode(raw, out, 1) == 15);
+    IT_ASSERT(std::string(out, 15) == "xzasdmnbvcxzasd");
+    // a view at an odd bit offset
+    ict::bitstring shifted(raw.bit_size() + 3);
+    ict::bit_copy_n(raw.bit_begin(), raw.bit_size(), shifted.bit_begin() + 3);
+    IT_ASSERT(ict::gsm7_decode(ict::bitstring_view(shifted).substr(3), out,
+                               1) == 15);
+    IT_ASSERT(std::string(out, 15) == "xzasdmnbvcxzasd");
+
+    // the rest of the alphabet, and the extension table behind an escape
+    IT_ASSERT(ict::to_gsm7("a_b") == ict::bitstring("E18818"));
+    IT_ASSERT(ict::to_gsm7("\xC2\xA3") == ict::bitstring("01")); // pound
+    IT_ASSERT(ict::to_gsm7("[") == ict::bitstring("1B1E"));
+    IT_ASSERT(ict::to_gsm7("\xE2\x82\xAC") == ict::bitstring("9B32")); // euro
+    IT_ASSERT(ict::gsm7(ict::bitstring("E18818")) == "a_b");
+    IT_ASSERT(ict::gsm7(ict::bitstring("9B32")) == "\xE2\x82\xAC");
+    // every character beyond ASCII is found again from its UTF-8
+    for (unsigned i = 0; i < 128; ++i) {
+        unsigned c = ict::detail::gsm7_alphabet[i];
+        if (c < 0x80)
+            continue;
+        unsigned char utf8[3];
+        std::string text(reinterpret_cast<char *>(utf8),
+                         ict::detail::put_utf8(utf8, c));
+        IT_ASSERT_MSG(i, ict::gsm7(ict::to_gsm7(text)) == text);
+    }
+    IT_ASSERT(ict::gsm7_length("a[b]", 4) == 6);
+    IT_ASSERT(ict::to_gsm7("a`b") == ict::to_gsm7("a?b"));
+    // an escape before a septet the extension table lacks reads as that
+    // septet, and one on its own as a space
+    IT_ASSERT(ict::gsm7(ict::bitstring("9B20")) == "A");
+    IT_ASSERT(ict::gsm7(ict::bitstring("1B")) == " ");
+
+    // a final '@' is only padding when the septets fill the last byte, and
+    // seven spare bits are filled with a CR
+    IT_ASSERT(ict::gsm7(ict::to_gsm7("ab@")) == "ab@");
+    IT_ASSERT(ict::to_gsm7("1234567") == ict::bitstring("31D98C56B3DD1A"));
+    IT_ASSERT(ict::gsm7(ict::bitstring("31D98C56B3DD1A")) == "1234567");
+    IT_ASSERT(ict::gsm7(ict::bitstring("31D98C56B3DD00")) == "1234567");
+    IT_ASSERT(ict::gsm7(ict::to_gsm7("1234567@", 1), 1) == "1234567@");
+
+    // round trips for every fill and length, through both the 8 character
+    // and the single character paths
+    const std::string alphabet = "@$ abcXYZ0189!?\n\r";
+    std::mt19937 engine(5);
+    for (size_t fill = 0; fill < 7; ++fill) {
+        for (size_t n = 0; n < 40; ++n) {
+            std::string text;
+            for (size_t i = 0; i < n; ++i)
+                text += alphabet[engine() % alphabet.size()];
+            // a final '@' or CR that fills the last byte reads as padding
+            if (n && (fill + 7 * n) % 8 == 0 &&
+                (text.back() == '@' || text.back() == '\r'))
+                text.back() = 'a';
+            auto bits = ict::to_gsm7(text, fill);
+            IT_ASSERT(bits.byte_size() == ict::gsm7_encoded_size(n, fill));
+            IT_ASSERT_MSG(fill << ' ' << text, ict::gsm7(bits, fill) == text);
+
+            // the same as the byte at a time unpacker, which only takes a
+            // zero septet as padding
+            if (!fill && n % 8 != 7) {
+                auto unpacked =
+                    ict::detail::unpack_bytes(ict::detail::to_uchar_array(bits));
+                ict::detail::map_to_ascii(unpacked);
+                IT_ASSERT(std::string(unpacked.begin(), unpacked.end()) ==
+                          text);
+            }
+        }
+    }
+
+    // and with every character of the default alphabet and the extension
+    // table, as UTF-8
+    std::vector<std::string> chars;
+    for (unsigned i = 0; i < 128; ++i) {
+        unsigned char c[3];
+        if (i != ict::detail::gsm7_escape)
+            chars.emplace_back(c, c + ict::detail::put_utf8(
+                                          c, ict::detail::gsm7_alphabet[i]));
+    }
+    for (auto &e : ict::detail::gsm7_extension) {
+        unsigned char c[3];
+        chars.emplace_back(c, c + ict::detail::put_utf8(c, e[1]));
+    }
+    for (size_t fill = 0; fill < 7; ++fill) {
+        for (size_t n = 0; n < 40; ++n) {
+            std::string text;
+            for (size_t i = 0; i < n; ++i)
+                text += chars[engine() % chars.size()];
+            auto len = ict::gsm7_length(text.data(), text.size());
+            if (len && (fill + 7 * len) % 8 == 0 &&
+                (text.back() == '@' || text.back() == '\r'))
+                text.back() = 'a';
+            auto bits = ict::to_gsm7(text, fill);
+            IT_ASSERT(bits.byte_size() == ict::gsm7_encoded_size(len, fill));
+            IT_ASSERT_MSG(fill << ' ' << text, ict::gsm7(bits, fill) == text);
+        }
+    }
+}
+
+void bitstring_unit::ascii7() {
+    // 'a' is 1100001, 'b' 1100010
+    IT_ASSERT(ict::bitstring(7, "ab") == ict::bitstring("@11000011100010"));
+    IT_ASSERT(ict::bitstring(7, "").empty());
+    IT_ASSERT(ict::to_ascii7(ict::bitstring("@11000011100010")) == "ab");
+    // the top bit is dropped
+    IT_ASSERT(ict::bitstring(7, "\xE1") == ict::bitstring("@1100001"));
+
+    std::mt19937 engine(17);
+    for (size_t n : {1, 7, 8, 9, 15, 16, 17, 31, 64, 100}) {
+        std::string text;
+        for (size_t i = 0; i < n; ++i)
+            text += static_cast<char>(engine() % 128);
+
+        ict::bitstring expected(7 * n);
+        for (size_t i = 0; i < n; ++i)
+            for (size_t b = 0; b < 7; ++b)
+                if (text[i] & (0x40 >> b))
+                    expected.set(7 * i + b);
+
+        auto packed = ict::from_ascii7(text.data(), text.data() + n);
+        IT_ASSERT_MSG(n, packed == expected);
+        IT_ASSERT(ict::from_ascii7(text.begin(), text.end()) == expected);
+        IT_ASSERT(ict::to_ascii7(packed) == text);
+
+        // unpacking from any bit offset, with a partial character at the end
+        for (size_t off : {1, 3, 7}) {
+            ict::bitstring shifted(off + 7 * n + 5);
+            ict::bit_copy_n(packed.bit_begin(), packed.bit_size(),
+                            shifted.bit_begin() + off);
+            auto v = ict::bitstring_view(shifted).substr(off);
+            IT_ASSERT(ict::to_ascii7(v).substr(0, n) == text);
+            IT_ASSERT(ict::to_ascii7(v).size() == n);
+        }
+    }
+}
+
+namespace {
+constexpr unsigned char header[] = {0x45, 0x00, 0x05, 0xDC, 0x1C, 0x46,
+                                    0x40, 0x00, 0x40, 0x06, 0xB1, 0xE6};
+
+constexpr uint16_t fields_made_at_compile_time() {
+    unsigned char buf[4] = {};
+    ict::insert<3, 13>(buf, 0x1ABC);
+    return ict::extract<3, 13>(buf);
+}
+
+// Check one offset and width against read_bits() and a round trip through
+// insert().
+template <size_t Offset, size_t Width> bool check_field() {
+    std::mt19937_64 engine(Offset * 100 + Width);
+    unsigned char buf[24];
+    for (auto &b : buf)
+        b = static_cast<unsigned char>(engine());
+    auto expected = ict::detail::read_bits(buf, Offset, Width);
+    if (ict::extract<Offset, Width, uint64_t>(buf) != expected)
+        return false;
+
+    // sign extension
+    auto s = ict::extract_signed<Offset, Width, int64_t>(buf);
+    auto sign = (expected >> (Width - 1)) & 1;
+    if ((s < 0) != (sign == 1) ||
+        (static_cast<uint64_t>(s) & ict::detail::field_mask<Width>()) !=
+            expected)
+        return false;
+
+    unsigned char copy[24];
+    std::copy(buf, buf + 24, copy);
+    auto v = engine();
+    ict::insert<Offset, Width>(copy, v);
+    if (ict::extract<Offset, Width, uint64_t>(copy) !=
+        (v & ict::detail::field_mask<Width>()))
+        return false;
+    // nothing outside the field changed
+    ict::insert<Offset, Width>(copy, expected);
+    return std::equal(buf, buf + 24, copy);
+}
+
+template <size_t Offset, size_t... Widths> bool check_widths() {
+    return (check_field<Offset, Widths>() && ...);
+}
+} // namespace
+
+void bitstring_unit::fixed_fields() {
+    // an IPv4 header
+    static_assert(ict::extract<0, 4>(header) == 4, "version");
+    static_assert(ict::extract<4, 4>(header) == 5, "ihl");
+    static_assert(ict::extract<16, 16>(header) == 1500, "length");
+    static_assert(ict::extract<48, 3>(header) == 2, "flags");
+    static_assert(ict::extract<51, 13>(header) == 0, "fragment");
+    static_assert(ict::extract<72, 8>(header) == 6, "protocol");
+    static_assert(ict::extract_signed<80, 16>(header) == -19994, "checksum");
+    static_assert(std::is_same<decltype(ict::extract<3, 9>(header)),
+                               uint16_t>::value,
+                  "smallest type");
+    static_assert(fields_made_at_compile_time() == 0x1ABC, "insert");
+
+    IT_ASSERT((check_widths<0, 1, 7, 8, 9, 16, 31, 32, 33, 56, 57, 63, 64>()));
+    IT_ASSERT((check_widths<1, 1, 7, 8, 9, 16, 31, 32, 55, 56, 57, 63, 64>()));
+    IT_ASSERT((check_widths<5, 1, 3, 4, 11, 27, 59, 60, 64>()));
+    IT_ASSERT((check_widths<7, 1, 2, 9, 25, 57, 58, 64>()));
+    IT_ASSERT((check_widths<8, 1, 8, 64>()));
+    IT_ASSERT((check_widths<61, 3, 4, 12, 64>()));
+    IT_ASSERT((check_widths<100, 1, 5, 28, 60, 61, 64>()));
+
+    IT_ASSERT((ict::extract_signed<0, 4>(header) == 4));
+    IT_ASSERT((ict::extract_signed<6, 2>(header) == 1));
+    IT_ASSERT((ict::extract_signed<1, 2>(header) == -2));
+}
+
+void bitstring_unit::hashing() {
+    // the same bits at every offset and with anything after them
+    auto data = ict::random_bitstring(3000);
+    for (size_t len : {0, 1, 7, 8, 63, 64, 65, 127, 128, 129, 383, 384, 385,
+                       700, 1000, 2048}) {
+        auto expected = ict::hash(ict::bitstring_view(data).substr(0, len));
+        auto copy = ict::bitstring_view(data).substr(0, len).bits();
+        IT_ASSERT(ict::hash(copy) == expected);
+        IT_ASSERT(std::hash<ict::bitstring>()(copy) ==
+                  static_cast<size_t>(expected));
+        for (size_t off = 1; off < 16; ++off) {
+            ict::bitstring shifted(off + len + 9);
+            ict::bit_copy_n(copy.bit_begin(), len, shifted.bit_begin() + off);
+            for (size_t i = off + len; i < shifted.bit_size(); ++i)
+                shifted.set(i);
+            auto v = ict::bitstring_view(shifted).substr(off, len);
+            IT_ASSERT_MSG(len << ' ' << off, ict::hash(v) == expected);
+            IT_ASSERT(std::hash<ict::bitstring_view>()(v) ==
+                      static_cast<size_t>(expected));
+        }
+        IT_ASSERT(ict::hash(copy, 1) != expected);
+    }
+
+    // the length counts, not just the bits
+    IT_ASSERT(ict::hash(ict::bitstring("@0")) !=
+              ict::hash(ict::bitstring("@00")));
+    IT_ASSERT(ict::hash(ict::bitstring()) != ict::hash(ict::bitstring("@0")));
+    IT_ASSERT(ict::hash(ict::bitstring("#00")) !=
+              ict::hash(ict::bitstring("#0000")));
+
+    // every one bit change of a long string and every prefix gives a new hash
+    std::unordered_set<uint64_t> hashes;
+    auto bits = ict::random_bitstring(1000);
+    for (size_t i = 0; i < bits.bit_size(); ++i) {
+        auto flipped = bits;
+        if (flipped.at(i))
+            flipped.reset(i);
+        else
+            flipped.set(i);
+        hashes.insert(ict::hash(flipped));
+        hashes.insert(ict::hash(ict::bitstring_view(bits).substr(0, i)));
+    }
+    IT_ASSERT(hashes.size() == 2000);
+
+    std::unordered_map<ict::bitstring, int> cache;
+    cache[ict::bitstring("#0102")] = 1;
+    cache[ict::bitstring("@0000000100000010")] += 1;
+    cache[ict::bitstring("@000000010000001")] = 3;
+    IT_ASSERT(cache.size() == 2);
+    IT_ASSERT(cache[ict::bitstring("#0102")] == 2);
+}
+
+void bitstring_unit::raw_streams() {
+    // exactly sized, so reading past the end would show up under asan
+    const size_t bytes = 37;
+    std::unique_ptr<unsigned char[]> raw(new unsigned char[bytes]);
+    auto bits = ict::random_bitstring(bytes * 8);
+    std::copy(bits.begin(), bits.end(), raw.get());
+
+    for (size_t len : {bytes * 8, bytes * 8 - 3, size_t(65), size_t(0)}) {
+        ict::ibitstream a(raw.get(), len);
+        auto owned = ict::bitstring_view(bits).substr(0, len).bits();
+        ict::ibitstream b(owned);
+        IT_ASSERT(a.remaining() == len);
+        for (size_t n = 1; !b.eobits(); n = n % 64 + 7) {
+            IT_ASSERT(a.tellg() == b.tellg());
+            IT_ASSERT(a.peek_uint(std::min(n, b.remaining())) ==
+                      b.peek_uint(std::min(n, b.remaining())));
+            IT_ASSERT(a.read_uint(n) == b.read_uint(n));
+        }
+        IT_ASSERT(a.eobits());
+        IT_ASSERT(a.read_uint(8) == 0);
+    }
+
+    // a view starting part way into a byte
+    auto v = ict::bitstring_view(raw.get(), 200, 13);
+    ict::ibitstream is(v);
+    IT_ASSERT(is.read_uint(3) == ict::detail::read_bits(raw.get(), 13, 3));
+    IT_ASSERT(is.read_view(100) == v.substr(3, 100));
+    IT_ASSERT(is.tellg() == 103);
+    IT_ASSERT(is.read(97) == v.substr(103));
+    IT_ASSERT(is.eobits());
+
+    // constraints and marks work the same
+    ict::ibitstream c(raw.get(), bytes * 8);
+    c.seek(16);
+    {
+        ict::constraint limit(c, 24);
+        ict::bitmarker mark(c);
+        IT_ASSERT(c.remaining() == 24);
+        IT_ASSERT(c.last_mark() == 16);
+        c.read_uint(24);
+        IT_ASSERT(c.eobits());
+    }
+    IT_ASSERT(c.remaining() == bytes * 8 - 40);
+}
+
+// Feed bits a few bytes at a time, like a socket would.
+static ict::ibitstream::source chunks_of(const ict::bitstring &bits,
+                                         size_t step) {
+    auto pos = std::make_shared<size_t>(0);
+    return [&bits, step, pos](unsigned char *p, size_t n) {
+        n = std::min({n, step, bits.byte_size() - *pos});
+        std::copy(bits.begin() + *pos, bits.begin() + *pos + n, p);
+        *pos += n;
+        return n;
+    };
+}
+
+void bitstring_unit::streaming() {
+    auto bits = ict::random_bitstring(997 * 8);
+
+    // the same reads as from the whole bitstring, whatever the chunking
+    for (size_t step : {1, 3, 7, 64}) {
+        for (size_t chunk : {1, 5, 32}) {
+            ict::ibitstream a(chunks_of(bits, step), chunk);
+            ict::ibitstream b(bits);
+            for (size_t n = 1; !b.eobits(); n = n % 71 + 5) {
+                IT_ASSERT(!a.eobits());
+                IT_ASSERT(a.tellg() == b.tellg());
+                auto k = std::min(n, b.remaining());
+                IT_ASSERT(a.peek_uint(std::min<size_t>(k, 64)) ==
+                          b.peek_uint(std::min<size_t>(k, 64)));
+                if (n % 3 == 0)
+                    IT_ASSERT(a.read_view(n) == b.read_view(n));
+                else if (n % 3 == 1)
+                    IT_ASSERT(a.read(n) == b.read(n));
+                else
+                    IT_ASSERT(a.read_uint(std::min<size_t>(n, 64)) ==
+                              b.read_uint(std::min<size_t>(n, 64)));
+            }
+            IT_ASSERT(a.eobits());
+            IT_ASSERT(a.remaining() == 0);
+            IT_ASSERT(a.tellg() == bits.bit_size());
+            IT_ASSERT(a.read_uint(8) == 0);
+        }
+    }
+
+    // constraints and marks span chunks and report absolute positions
+    ict::ibitstream s(chunks_of(bits, 3), 4);
+    s.seek(5000);
+    {
+        ict::constraint limit(s, 300);
+        ict::bitmarker mark(s);
+        IT_ASSERT(s.remaining() == 300);
+        IT_ASSERT(s.read(150) == ict::bitstring_view(bits).substr(5000, 150));
+        IT_ASSERT(s.last_mark() == 5000);
+        IT_ASSERT(s.read(1000) == ict::bitstring_view(bits).substr(5150, 150));
+        IT_ASSERT(s.eobits());
+        IT_ASSERT(s.tellg() == 5300);
+    }
+    IT_ASSERT(!s.eobits());
+
+    // read_to() looks ahead a chunk at a time too
+    s.seek(4);
+    auto ch = bits.begin()[900];
+    size_t to = 663;
+    while (bits.begin()[to] != ch)
+        ++to;
+    IT_ASSERT(s.read_to(static_cast<char>(ch)) ==
+              ict::bitstring_view(bits).substr(5304, (to - 662) * 8));
+    ict::bitstring few("#01020304");
+    ict::ibitstream no(chunks_of(few, 1), 1);
+    IT_ASSERT_MSG("read_to runs out", [&]() {
+        try {
+            no.read_to('\x7f');
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+
+    // a seek past everything buffered skips over the input
+    ict::ibitstream far(chunks_of(bits, 7), 16);
+    far.seek(8 * 900 + 3);
+    IT_ASSERT(far.read_uint(13) == ict::detail::read_bits(bits.begin(),
+                                                          8 * 900 + 3, 13));
+    far.seek(8 * 997 - far.tellg());
+    IT_ASSERT(far.eobits());
+    IT_ASSERT(far.tellg() == 8 * 997);
+
+    // and so does a peek past the end of the input, as does one past the end
+    // of a whole bitstring
+    ict::ibitstream ends(chunks_of(bits, 5), 8);
+    ends.seek(8 * 990);
+    IT_ASSERT(ends.peek_uint(64, 100) == 0);
+    IT_ASSERT(ends.peek_uint(16, 8 * 6) ==
+              ict::detail::read_bits(bits.begin(), 8 * 996, 8) << 8);
+    ict::ibitstream whole(few);
+    IT_ASSERT(whole.peek_uint(64, 1000) == 0);
+    IT_ASSERT(whole.peek_uint(8, 24) == 4);
+
+    // memory is bounded by the largest read, not the length of the input
+    size_t fed = 0;
+    ict::ibitstream big(
+        [&fed](unsigned char *p, size_t n) {
+            if (fed >= (1 << 22))
+                return size_t(0);
+            std::fill(p, p + n, static_cast<unsigned char>(fed));
+            fed += n;
+            return n;
+        },
+        4096);
+    size_t total = 0;
+    while (!big.eobits()) {
+        ict::constraint message(big, 8 * 1000);
+        total += big.read_view(big.remaining()).bit_size();
+    }
+    IT_ASSERT(total == fed * 8);
+    IT_ASSERT(big.buffer_size() <= 4096 + 1001);
+}
+
+void bitstring_unit::deep_constraints() {
+    // past the inline capacity of the stacks and back again, twice
+    auto bits = ict::random_bitstring(4096);
+    ict::ibitstream is(bits);
+    for (int pass = 0; pass < 2; ++pass) {
+        std::vector<size_t> ends;
+        for (size_t level = 0; level < 50; ++level) {
+            is.constrain(is.remaining() - 8);
+            is.mark();
+            ends.push_back(is.tellg() + is.remaining());
+            IT_ASSERT(is.read_uint(8) == bits.begin()[is.tellg() / 8 - 1]);
+            IT_ASSERT(is.last_mark() == is.tellg() - 8);
+        }
+        for (size_t level = 50; level-- > 0;) {
+            IT_ASSERT(is.tellg() + is.remaining() == ends[level]);
+            is.unmark();
+            is.unconstrain();
+        }
+        IT_ASSERT(is.remaining() == 4096 - is.tellg());
+        IT_ASSERT(is.last_mark() == 0);
+    }
+
+    ict::detail::inline_stack<int, 2> stack;
+    for (int i = 0; i < 100; ++i)
+        stack.push_back(i);
+    IT_ASSERT(stack.size() == 100);
+    for (int i = 99; i >= 0; --i) {
+        IT_ASSERT(stack.back() == i);
+        stack.pop_back();
+    }
+    IT_ASSERT(stack.empty());
+}
+
+void bitstring_unit::checkpoints() {
+    auto bits = ict::random_bitstring(2000);
+    ict::ibitstream is(bits);
+    is.seek(5);
+
+    // a failed alternative leaves no trace
+    auto cp = is.checkpoint();
+    IT_ASSERT_MSG("first alternative fails", [&]() {
+        try {
+            ict::constraint c(is, 100);
+            ict::bitmarker m(is);
+            is.read_uint(40);
+            IT_PANIC("not this one");
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+    is.rewind(cp);
+    IT_ASSERT(is.tellg() == 5);
+    IT_ASSERT(is.remaining() == 1995);
+    IT_ASSERT(is.read_uint(12) == ict::detail::read_bits(bits.begin(), 5, 12));
+    is.commit(cp);
+
+    // constraints and marks made since are dropped, nested checkpoints too
+    is.constrain(500);
+    auto outer = is.checkpoint();
+    is.constrain(50);
+    is.mark();
+    is.read(30);
+    auto inner = is.checkpoint();
+    is.read(20);
+    IT_ASSERT(is.eobits());
+    is.rewind(inner);
+    IT_ASSERT(is.tellg() == 47 && is.remaining() == 20);
+    is.rewind(outer);
+    IT_ASSERT(is.tellg() == 17 && is.remaining() == 500);
+    IT_ASSERT(is.last_mark() == 0);
+    IT_ASSERT_MSG("inner went with the rewind to outer", [&]() {
+        try {
+            is.rewind(inner);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+    is.commit(outer);
+    IT_ASSERT_MSG("already committed", [&]() {
+        try {
+            is.rewind(outer);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+
+    // the stacks can't be shallower than at the checkpoint
+    cp = is.checkpoint();
+    is.unconstrain();
+    IT_ASSERT_MSG("constraint removed", [&]() {
+        try {
+            is.rewind(cp);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+    is.commit(cp);
+
+    // nor replaced by others at the same depth, even above a newer checkpoint
+    is.constrain(100);
+    cp = is.checkpoint();
+    is.unconstrain();
+    is.constrain(300);
+    auto later = is.checkpoint();
+    IT_ASSERT_MSG("constraint replaced", [&]() {
+        try {
+            is.rewind(cp);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+    is.rewind(later);
+    IT_ASSERT(is.remaining() == 300);
+    is.commit(later);
+    IT_ASSERT_MSG("constraint replaced before a commit", [&]() {
+        try {
+            is.rewind(cp);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+    is.commit(cp);
+    is.unconstrain();
+
+    // a committed checkpoint stays committed when a new one takes its place
+    auto done = is.checkpoint();
+    is.commit(done);
+    cp = is.checkpoint();
+    IT_ASSERT_MSG("committed before", [&]() {
+        try {
+            is.rewind(done);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+    is.rewind(cp);
+    is.commit(cp);
+
+    // a streaming ibitstream keeps its input from the oldest checkpoint on
+    size_t pos = 0;
+    ict::ibitstream s(
+        [&](unsigned char *p, size_t n) {
+            n = std::min({n, size_t(3), bits.byte_size() - pos});
+            std::copy_n(bits.begin() + pos, n, p);
+            pos += n;
+            return n;
+        },
+        4);
+    s.seek(101);
+    cp = s.checkpoint();
+    ict::bitstring first;
+    for (int i = 0; i < 70; ++i)
+        first.append(s.read(10));
+    IT_ASSERT(s.buffer_size() >= 88);
+    s.rewind(cp);
+    IT_ASSERT(s.read(700) == first);
+    IT_ASSERT(first == ict::bitstring_view(bits).substr(101, 700));
+    s.rewind(cp);
+    IT_ASSERT(s.read_uint(9) == ict::detail::read_bits(bits.begin(), 101, 9));
+    s.commit(cp);
+    s.read(1000);
+    IT_ASSERT(s.tellg() == 1110);
+    IT_ASSERT(s.read(1000) == ict::bitstring_view(bits).substr(1110));
+}
+
 void bitstring_unit::modern_sms_difficult() {
     // E139F92CCF9BF379333D9FA7CD6435DBED86CBC17034992C041809042510C87456A301
     // should be: asdgryfyyftyy43256778908422!@#$$%^^&gjh
@@ -695,6 +1329,807 @@ void bitstring_unit::const_bit_iterators() {
     detail::const_test(sm);
 }
 
+// Copy len bits between every combination of source and destination offsets
+// and compare against a bit at a time copy.  Destination bits outside the range
+// must be left alone.
+void bitstring_unit::bit_copy_offsets() {
+    auto src = random_bitstring(1200);
+    auto fill = random_bitstring(1200);
+    for (size_t so = 0; so < 8; ++so) {
+        for (size_t d = 0; d < 8; ++d) {
+            for (size_t len = 0; len < 1100; len += (len < 140 ? 1 : 97)) {
+                auto x = fill;
+                auto y = fill;
+                bit_copy_n(src.bit_begin() + so, len, x.bit_begin() + d);
+                for (size_t i = 0; i < len; ++i)
+                    y.bit_begin()[d + i].value(src.at(so + i));
+                IT_ASSERT_MSG(so << ", " << d << ", " << len, x == y);
+            }
+        }
+    }
+}
+
+void bitstring_unit::random_access_iterators() {
+    static_assert(
+        std::is_same<std::iterator_traits<const_bit_iterator>::iterator_category,
+                     std::random_access_iterator_tag>::value,
+        "const_bit_iterator must be random access");
+
+    auto x = random_bitstring(1024);
+    auto first = x.bit_begin();
+    auto last = x.bit_end();
+    IT_ASSERT(std::distance(first, last) == 1024);
+    IT_ASSERT(last - first == 1024);
+    IT_ASSERT(first - last == -1024);
+
+    for (std::ptrdiff_t i = 0; i < 1024; i += 37) {
+        auto a = first + i;
+        IT_ASSERT(a - first == i);
+        IT_ASSERT(a[0].value() == x.at(static_cast<size_t>(i)));
+        IT_ASSERT(first[i].value() == x.at(static_cast<size_t>(i)));
+        for (std::ptrdiff_t j = -i; j < 1024 - i; j += 13) {
+            auto b = a + j;
+            IT_ASSERT_MSG(i << ", " << j, b - first == i + j);
+            IT_ASSERT(b - j == a);
+            IT_ASSERT((j < 0) == (b < a));
+            IT_ASSERT((j > 0) == (b > a));
+            IT_ASSERT((j <= 0) == (b <= a));
+            IT_ASSERT((j >= 0) == (b >= a));
+            auto c = b;
+            c -= j;
+            IT_ASSERT(c == a);
+            c += -i;
+            IT_ASSERT(c == first);
+        }
+    }
+
+    // iterators made from the same byte with a large offset compare equal
+    // to ones that were walked there
+    auto a = bit_iterator(x.data(), 67);
+    auto b = x.bit_begin();
+    for (int i = 0; i < 67; ++i)
+        ++b;
+    IT_ASSERT(a == b);
+    IT_ASSERT(!(a < b) && !(b < a));
+    --b;
+    IT_ASSERT(b < a);
+    std::advance(b, 1);
+    IT_ASSERT(a == b);
+
+    // standard algorithms
+    auto n = std::count_if(first, last, [](const detail::bit_proxy &p) {
+        return p.value();
+    });
+    size_t ones = 0;
+    for (size_t i = 0; i < x.bit_size(); ++i)
+        ones += x.at(i);
+    IT_ASSERT(static_cast<size_t>(n) == ones);
+}
+
+void bitstring_unit::views() {
+    {
+        ict::bitstring bits("@1110001101");
+        ict::bitstring_view v(bits);
+        IT_ASSERT(v.bit_size() == 10);
+        IT_ASSERT(v == bits);
+        IT_ASSERT(v == "@1110001101");
+        IT_ASSERT(v.substr(3) == "@0001101");
+        IT_ASSERT(v.substr(3, 4) == "@0001");
+        IT_ASSERT(v.substr(3).substr(3, 2) == "@11");
+        IT_ASSERT(v.substr(10).empty());
+        IT_ASSERT(v.substr(3, 4) != v.substr(4, 4));
+        IT_ASSERT(ict::to_string(v.substr(1)) == "@110001101");
+        IT_ASSERT(ict::to_string(v.substr(2, 8)) == "#8D");
+        IT_ASSERT(ict::to_integer<unsigned>(v.substr(2, 8)) == 0x8D);
+        IT_ASSERT(ict::to_integer<unsigned>(v.substr(7)) == 5);
+        IT_ASSERT(v.substr(2, 8).bits() == "#8D");
+        IT_ASSERT(std::count_if(v.bit_begin(), v.bit_end(),
+                                [](const detail::bit_proxy &p) {
+                                    return p.value();
+                                }) == 6);
+    }
+    {
+        // every slice compares equal to the equivalent substr
+        auto bits = random_bitstring(300);
+        ict::bitstring_view v(bits);
+        for (size_t i = 0; i < 300; i += 7) {
+            for (size_t len = 0; i + len <= 300; len += 11) {
+                auto a = v.substr(i, len);
+                auto b = bits.substr(i, len);
+                IT_ASSERT(a == b);
+                IT_ASSERT(a.bits() == b);
+                IT_ASSERT(ict::to_string(a) == ict::to_string(b));
+                IT_ASSERT(ict::to_integer<uint64_t>(a) ==
+                          ict::to_integer<uint64_t>(b));
+                IT_ASSERT(ict::to_integer<uint32_t>(a) ==
+                          ict::to_integer<uint32_t>(b));
+                if (len && i + len < 300)
+                    IT_ASSERT(a != v.substr(i + 1, len) ||
+                              b == bits.substr(i + 1, len));
+            }
+        }
+    }
+    {
+        ict::bitstring bits("0001");
+        ict::bitstring_view v(bits);
+        IT_ASSERT(ict::to_integer<uint16_t>(v, true) == 0x0001);
+        IT_ASSERT(ict::to_integer<uint16_t>(v, false) == 0x0100);
+        IT_ASSERT(ict::to_integer<uint32_t>(ict::bitstring("0100"), false) ==
+                  1);
+    }
+    {
+        ict::bitstring bits("@111000110");
+        ict::ibitstream is(bits);
+        auto a = is.read_view(3);
+        IT_ASSERT(a == "@111");
+        IT_ASSERT(is.peek_view(3) == "@000");
+        IT_ASSERT(is.peek_view(3, 3) == "@110");
+        IT_ASSERT(is.read_blind_view(4) == "@0001");
+        IT_ASSERT(is.read_view(10) == "@10");
+        IT_ASSERT(is.eobits());
+    }
+}
+
+void bitstring_unit::ibs_integers() {
+    {
+        ict::bitstring bits("@101 11111 00000000001 1");
+        ict::ibitstream is(bits);
+        IT_ASSERT(is.peek_uint(3) == 5);
+        IT_ASSERT(is.peek_uint(5, 3) == 31);
+        IT_ASSERT(is.read_uint<unsigned>(3) == 5);
+        IT_ASSERT(is.read_int<int>(5) == -1);
+        IT_ASSERT(is.read_int<int>(11) == 1);
+        IT_ASSERT(is.remaining() == 1);
+        IT_ASSERT(is.read_uint(8) == 1); // limited to remaining()
+        IT_ASSERT(is.eobits());
+        IT_ASSERT(is.read_uint(8) == 0);
+    }
+    {
+        // every width at every offset, compared to read()/to_integer()
+        auto bits = random_bitstring(2048);
+        for (size_t s = 1; s <= 64; ++s) {
+            ict::ibitstream a(bits);
+            ict::ibitstream b(bits);
+            a.seek(s % 8);
+            b.seek(s % 8);
+            while (!a.eobits()) {
+                auto n = std::min(s, a.remaining());
+                auto peeked = a.peek_uint(n);
+                auto x = a.read_uint(s);
+                auto y = ict::to_integer<uint64_t>(b.read(s));
+                IT_ASSERT_MSG(s << ": " << x << " == " << y, x == y);
+                IT_ASSERT(peeked == x);
+
+                int64_t sx = static_cast<int64_t>(x);
+                if (n < 64 && (x >> (n - 1)))
+                    sx = static_cast<int64_t>(x - (uint64_t(1) << n));
+                a.seek(0);
+                IT_ASSERT(a.tellg() == b.tellg());
+                ict::ibitstream c(bits);
+                c.seek(a.tellg() - n);
+                IT_ASSERT(c.read_int(n) == sx);
+            }
+        }
+    }
+    {
+        // constraints apply
+        ict::bitstring bits("FFFF");
+        ict::ibitstream is(bits);
+        ict::constraint c(is, 4);
+        IT_ASSERT(is.read_uint(8) == 0xF);
+        IT_ASSERT(is.eobits());
+    }
+    {
+        // more than 64 bits are taken as 64
+        ict::bitstring bits("0123456789ABCDEF FEDC");
+        ict::ibitstream is(bits);
+        IT_ASSERT(is.peek_uint(100, 4) == 0x123456789ABCDEFF);
+        IT_ASSERT(is.read_uint(100) == 0x0123456789ABCDEF);
+        IT_ASSERT(is.tellg() == 64);
+        is.seek(0);
+        IT_ASSERT(is.read_int(65) == -292);
+        IT_ASSERT(is.eobits());
+    }
+}
+
+void bitstring_unit::obs_integers() {
+    {
+        ict::obitstream os;
+        os.write_uint(5u, 3).write_uint(-1, 5).write_uint(1, 11);
+        IT_ASSERT(os.bit_size() == 19);
+        IT_ASSERT(os.bits() == "@101 11111 00000000001");
+        os.write_bits(0xFFFFFFFFFFFFFFFF, 1);
+        IT_ASSERT(os.bits() == "@101 11111 00000000001 1");
+        os << ict::bitstring("@00");
+        os.write_uint(uint8_t(0xA5));
+        IT_ASSERT(os.bits() == "@101 11111 00000000001 1 00 10100101");
+    }
+    {
+        // wider than 64 bits pads on the left
+        ict::obitstream os;
+        os.write_uint(3u, 70);
+        IT_ASSERT(os.bits() == ict::from_integer<unsigned>(3, 70));
+        // write_bits() too, and the writes after it still line up
+        os.write_bits(0xABCD, 200).write_bits(0xE, 4);
+        auto bits = os.bits();
+        IT_ASSERT(bits.bit_size() == 274);
+        IT_ASSERT(bits.substr(70, 136) == ict::bitstring(136));
+        ict::ibitstream is(bits);
+        is.seek(70 + 136);
+        IT_ASSERT(is.read_uint(64) == 0xABCD);
+        IT_ASSERT(is.read_uint(4) == 0xE);
+    }
+    {
+        // start with a partially filled byte
+        ict::obitstream os(ict::bitstring("@1011"));
+        os.write_bits(0, 4);
+        os.write_bits(0xFF, 8);
+        IT_ASSERT(os.bits() == "#B0FF");
+    }
+    {
+        // random widths against from_integer() and operator<<
+        std::mt19937_64 engine(7);
+        ict::obitstream a;
+        ict::obitstream b;
+        for (int i = 0; i < 5000; ++i) {
+            uint64_t v = engine();
+            size_t n = engine() % 65;
+            if (i % 97 == 0) {
+                auto x = random_bitstring(n + 1);
+                a << x;
+                b << x;
+                continue;
+            }
+            a.write_uint(v, n);
+            if (n)
+                b << ict::from_integer(v, n);
+        }
+        auto x = a.bits();
+        auto y = b.bits();
+        IT_ASSERT(x.bit_size() == y.bit_size());
+        IT_ASSERT(x == y);
+    }
+    {
+        ict::obitstream os;
+        IT_ASSERT(os.bits().empty());
+        IT_ASSERT(std::move(os).take_bits().empty());
+    }
+    {
+        // take_bits() hands over the storage
+        ict::bitstring b("@101");
+        b.reserve(20000);
+        auto p = b.data();
+        ict::obitstream os(std::move(b));
+        for (int i = 0; i < 1000; ++i)
+            os.write_uint(i, 13);
+        os << ict::bitstring("#ABCD");
+        os.write_bits(1, 1);
+        auto copy = os.bits();
+        IT_ASSERT(copy.bit_size() == 3 + 13000 + 16 + 1);
+        IT_ASSERT(copy.data() != p);
+        auto taken = std::move(os).take_bits();
+        IT_ASSERT(taken.data() == p);
+        IT_ASSERT(taken == copy);
+        IT_ASSERT(os.bit_size() == 0);
+        ict::ibitstream is(taken);
+        IT_ASSERT(is.read(3) == "@101");
+        for (unsigned i = 0; i < 1000; ++i)
+            IT_ASSERT(is.read_uint(13) == i);
+        IT_ASSERT(is.read(16) == "#ABCD");
+        IT_ASSERT(is.read(1) == "@1");
+    }
+}
+
+namespace {
+// Counts outstanding allocations and forwards to global new.
+struct counting_resource : ict::memory_resource {
+    int allocs = 0;
+    int frees = 0;
+
+  private:
+    void *do_allocate(size_t bytes, size_t) override {
+        ++allocs;
+        return ::operator new(bytes);
+    }
+    void do_deallocate(void *p, size_t, size_t) override {
+        ++frees;
+        ::operator delete(p);
+    }
+#ifdef ICT_HAS_PMR
+    bool do_is_equal(const std::pmr::memory_resource &o) const
+        noexcept override {
+        return this == &o;
+    }
+#endif
+};
+} // namespace
+
+void bitstring_unit::resources() {
+    // big enough to go on the heap
+    const size_t big = ict::bitstring::local_bits + 72;
+    counting_resource r;
+    {
+        // explicit resource, inline bits never allocate
+        ict::bitstring a(big, &r);
+        ict::bitstring b(8, &r);
+        IT_ASSERT(r.allocs == 1);
+        IT_ASSERT(a.resource() == &r);
+        IT_ASSERT(b.resource() == nullptr);
+        ict::bitstring c(ict::random_bitstring(big + 100), &r);
+        IT_ASSERT(r.allocs == 2);
+
+        // moves keep the resource, copies use the thread resource
+        auto d = std::move(c);
+        IT_ASSERT(d.resource() == &r);
+        auto e = d;
+        IT_ASSERT(e.resource() == nullptr);
+        IT_ASSERT(e == d);
+        IT_ASSERT(r.allocs == 2);
+    }
+    IT_ASSERT(r.frees == 2);
+
+    r.allocs = r.frees = 0;
+    {
+        auto msg = ict::random_bitstring(5 * big + 24);
+        std::vector<ict::bitstring> fields;
+        {
+            ict::bitstring_resource_scope scope(&r);
+            IT_ASSERT(ict::bitstring_resource() == &r);
+            ict::ibitstream is(msg);
+            while (!is.eobits())
+                fields.push_back(is.read(big));
+            IT_ASSERT(r.allocs == 5); // the last 24 bits are inline
+
+            // growing keeps the resource
+            ict::memory_resource *global = nullptr;
+            auto x = ict::bitstring(big, global);
+            x.resize(big * 2);
+            IT_ASSERT(x.resource() == nullptr);
+            fields[0].resize(big * 3);
+            IT_ASSERT(fields[0].resource() == &r);
+        }
+        IT_ASSERT(ict::bitstring_resource() == nullptr);
+        IT_ASSERT(fields[3] == msg.substr(3 * big, big));
+
+        // moving back to inline storage releases the allocation
+        auto frees = r.frees;
+        fields[1].resize(10);
+        IT_ASSERT(r.frees == frees);
+        fields[1].shrink_to_fit();
+        IT_ASSERT(r.frees == frees + 1);
+        IT_ASSERT(fields[1].local());
+        IT_ASSERT(fields[1] == msg.substr(big, 10));
+    }
+    IT_ASSERT(r.allocs == r.frees);
+
+#ifdef ICT_HAS_PMR
+    {
+        unsigned char buf[4096];
+        std::pmr::monotonic_buffer_resource arena(buf, sizeof(buf));
+        ict::bitstring_resource_scope scope(&arena);
+        auto a = ict::random_bitstring(big);
+        IT_ASSERT(a.resource() == &arena);
+        IT_ASSERT(a.data() > reinterpret_cast<char *>(buf) &&
+                  a.data() < reinterpret_cast<char *>(buf + sizeof(buf)));
+        auto b = ict::bitstring(a, nullptr);
+        IT_ASSERT(b == a);
+    }
+#endif
+}
+
+void bitstring_unit::capacity() {
+    {
+        ict::bitstring a;
+        IT_ASSERT(a.capacity() == ict::bitstring::local_bits);
+        a.reserve(1000);
+        IT_ASSERT(a.capacity() >= 1000);
+        IT_ASSERT(a.empty());
+        IT_ASSERT(!a.local());
+        auto p = a.data();
+        for (int i = 0; i < 1000; ++i)
+            a.push_back(i % 3 == 0);
+        IT_ASSERT(a.data() == p);
+        IT_ASSERT(a.bit_size() == 1000);
+        for (size_t i = 0; i < 1000; ++i)
+            IT_ASSERT(a.at(i) == (i % 3 == 0));
+
+        a.resize(20);
+        IT_ASSERT(a.data() == p);
+        IT_ASSERT(a == "@1001001001001001001 0");
+        a.shrink_to_fit();
+        IT_ASSERT(a.local());
+        IT_ASSERT(a == "@1001001001001001001 0");
+
+        // growing zeroes the new bits, including the rest of the last byte
+        a.resize(30);
+        IT_ASSERT(a == "@1001001001001001001 0 0000000000");
+    }
+    {
+        // geometric growth: few reallocations for many appends
+        ict::bitstring a;
+        const char *last = nullptr;
+        int moves = 0;
+        for (int i = 0; i < 100000; ++i) {
+            a.push_back(i & 1);
+            if (a.data() != last) {
+                last = a.data();
+                ++moves;
+            }
+        }
+        IT_ASSERT_MSG(moves, moves < 20);
+        IT_ASSERT(a.bit_size() == 100000);
+        IT_ASSERT(a.substr(99990) == "@0101010101");
+    }
+    {
+        auto x = ict::random_bitstring(77);
+        auto y = ict::random_bitstring(300);
+        ict::bitstring a("@101");
+        a.append(x).append(y).append(y.bit_begin() + 5, 11);
+        IT_ASSERT(a.bit_size() == 3 + 77 + 300 + 11);
+        IT_ASSERT(a.substr(0, 3) == "@101");
+        IT_ASSERT(a.substr(3, 77) == x);
+        IT_ASSERT(a.substr(80, 300) == y);
+        IT_ASSERT(a.substr(380) == y.substr(5, 11));
+
+        // append to self
+        auto b = a;
+        a.append(a);
+        IT_ASSERT(a.substr(0, b.bit_size()) == b);
+        IT_ASSERT(a.substr(b.bit_size()) == b);
+    }
+    {
+        // remove in place agrees with rebuilding from substrings
+        auto x = ict::random_bitstring(500);
+        for (size_t i = 0; i < 500; i += 37) {
+            for (size_t len : {0, 1, 7, 8, 9, 64, 65, 200}) {
+                auto y = x;
+                auto p = y.data();
+                y.remove(i, len);
+                auto n = std::min<size_t>(len, 500 - i);
+                IT_ASSERT(y.data() == p);
+                IT_ASSERT(y.bit_size() == 500 - n);
+                IT_ASSERT(y.substr(0, i) == x.substr(0, i));
+                IT_ASSERT(y.substr(i) == x.substr(i + n));
+            }
+        }
+        IT_ASSERT_MSG("remove past the end", [&]() {
+            try {
+                x.remove(501, 1);
+            } catch (std::exception &) {
+                return true;
+            }
+            return false;
+        }());
+    }
+    {
+        ict::bitstring a("@1");
+        ict::detail::pad_right(a, 12);
+        IT_ASSERT(a == "@100000000000");
+        ict::detail::pad_right(a, 4);
+        IT_ASSERT(a.bit_size() == 12);
+    }
+    {
+        // copy assignment reuses storage
+        ict::bitstring a(1000);
+        auto p = a.data();
+        auto c = ict::random_bitstring(500);
+        a = c;
+        IT_ASSERT(a.data() == p);
+        IT_ASSERT(a == c);
+        auto b = ict::random_bitstring(2000);
+        a = b;
+        IT_ASSERT(a == b);
+    }
+}
+
+void bitstring_unit::parsing() {
+    auto parse = [](const std::string &text, ict::bitstring &bits) {
+        return ict::parse_bitstring(text.data(), text.data() + text.size(),
+                                    bits);
+    };
+    {
+        // round trip every length across the block sizes
+        for (size_t len = 0; len < 300; ++len) {
+            auto x = ict::random_bitstring(len);
+            auto text = ict::to_string(x);
+            ict::bitstring y;
+            auto r = parse(text, y);
+            IT_ASSERT_MSG(text, r && r.ptr == text.data() + text.size());
+            IT_ASSERT_MSG(text, x == y);
+            IT_ASSERT(ict::bitstring(text) == x);
+
+            // lower case hex, and whitespace in all sorts of places
+            for (auto &c : text)
+                c = static_cast<char>(std::tolower(c));
+            std::string spaced;
+            for (size_t i = 0; i < text.size(); ++i) {
+                if (i % (len % 7 + 3) == 1)
+                    spaced += " \t\n"[i % 3];
+                spaced += text[i];
+            }
+            spaced += "\r\n";
+            IT_ASSERT_MSG(spaced, ict::bitstring(spaced) == x);
+        }
+    }
+    {
+        // errors report the offending character and leave bits empty
+        const std::string bad_chars = "gG/:@`\x80\xFFxz#";
+        for (size_t len : {2, 8, 15, 16, 17, 31, 32, 33, 64}) {
+            for (size_t pos = 0; pos < len; pos += 3) {
+                for (auto c : bad_chars) {
+                    std::string text(len, 'a');
+                    text[pos] = c;
+                    ict::bitstring bits("#1234");
+                    auto r = ict::parse_hex(text.data(),
+                                            text.data() + text.size(), bits);
+                    IT_ASSERT(!r);
+                    IT_ASSERT_MSG(text, r.ptr == text.data() + pos);
+                    IT_ASSERT(bits.empty());
+
+                    text.assign(len, '1');
+                    text[pos] = c == '#' ? '2' : c;
+                    r = ict::parse_binary(text.data(),
+                                          text.data() + text.size(), bits);
+                    IT_ASSERT(!r);
+                    IT_ASSERT_MSG(text, r.ptr == text.data() + pos);
+                }
+            }
+        }
+
+        ict::bitstring bits;
+        std::string odd = "#ABC";
+        auto r = parse(odd, bits);
+        IT_ASSERT(!r && r.ptr == odd.data() + odd.size());
+        IT_ASSERT(bits.empty());
+        IT_ASSERT(ict::bitstring("ABC").empty());
+        IT_ASSERT(ict::bitstring("@012").empty());
+    }
+    {
+        ict::bitstring bits;
+        IT_ASSERT(parse("", bits) && bits.empty());
+        IT_ASSERT(parse("  #  ", bits) && bits.empty());
+        IT_ASSERT(parse(" @ 1 ", bits) && bits == "@1");
+        IT_ASSERT(parse("\t#0a 0B", bits) && bits == "#0A0B");
+        IT_ASSERT(ict::bitstring(2, "0 1 1") == "@011");
+        IT_ASSERT(ict::bitstring(16, "ff 00") == "#FF00");
+
+        // whitespace doesn't leave a heap block behind for inline bits
+        auto wide = "#AABB" + std::string(400, ' ') + "CCDD";
+        IT_ASSERT(parse(wide, bits) && bits.local() && bits == "#AABBCCDD");
+    }
+}
+
+void bitstring_unit::bitwise() {
+    IT_ASSERT((ict::bitstring("@1100") & ict::bitstring("@1010")) == "@1000");
+    IT_ASSERT((ict::bitstring("@1100") | ict::bitstring("@1010")) == "@1110");
+    IT_ASSERT((ict::bitstring("@1100") ^ ict::bitstring("@1010")) == "@0110");
+    IT_ASSERT(~ict::bitstring("@1100") == "@0011");
+    IT_ASSERT((ict::bitstring("@0011") << 1) == "@0110");
+    IT_ASSERT((ict::bitstring("@0011") >> 1) == "@0001");
+    IT_ASSERT((ict::bitstring("@1011") << 9) == "@0000");
+    IT_ASSERT((ict::bitstring("@1011") >> 9) == "@0000");
+
+    // compare against bit at a time versions
+    for (size_t len : {1, 7, 8, 9, 63, 64, 65, 127, 128, 129, 200, 1000}) {
+        auto a = ict::random_bitstring(len);
+        auto b = ict::random_bitstring(len);
+        auto x = a & b;
+        auto y = a | b;
+        auto z = a ^ b;
+        auto w = ~a;
+        for (size_t i = 0; i < len; ++i) {
+            IT_ASSERT(x.at(i) == (a.at(i) && b.at(i)));
+            IT_ASSERT(y.at(i) == (a.at(i) || b.at(i)));
+            IT_ASSERT(z.at(i) == (a.at(i) != b.at(i)));
+            IT_ASSERT(w.at(i) == !a.at(i));
+        }
+        // tail bits stay clear, so padding can't leak into later operations
+        auto tail_clear = [len](const ict::bitstring &t) {
+            return !(len % 8) ||
+                   !(t.begin()[t.byte_size() - 1] & (0xFF >> (len % 8)));
+        };
+        IT_ASSERT(tail_clear(w));
+
+        for (size_t n : {size_t(0), size_t(1), size_t(3), size_t(8),
+                         size_t(13), size_t(64), size_t(71), len - 1, len,
+                         len + 5}) {
+            auto l = a << n;
+            auto r = a >> n;
+            IT_ASSERT(l.bit_size() == len && r.bit_size() == len);
+            for (size_t i = 0; i < len; ++i) {
+                IT_ASSERT_MSG(len << " << " << n,
+                              l.at(i) == (i + n < len && a.at(i + n)));
+                IT_ASSERT_MSG(len << " >> " << n,
+                              r.at(i) == (i >= n && a.at(i - n)));
+            }
+            IT_ASSERT(tail_clear(r));
+        }
+    }
+
+    auto a = ict::random_bitstring(100);
+    auto b = a;
+    b ^= a;
+    IT_ASSERT(b == ict::bitstring(100));
+    b |= a;
+    IT_ASSERT(b == a);
+    b &= ~a;
+    IT_ASSERT(b == ict::bitstring(100));
+
+    IT_ASSERT_MSG("size mismatch", [&]() {
+        try {
+            a &= ict::bitstring(99);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+}
+
+void bitstring_unit::bit_queries() {
+    ict::bitstring e;
+    IT_ASSERT(e.count() == 0 && e.none() && !e.any());
+    IT_ASSERT(e.find_first() == e.npos && e.find_last() == e.npos);
+    IT_ASSERT(e.find_next(0) == e.npos);
+
+    ict::bitstring a("@0010 0000 0000 1");
+    IT_ASSERT(a.count() == 2);
+    IT_ASSERT(a.find_first() == 2);
+    IT_ASSERT(a.find_next(2) == 12);
+    IT_ASSERT(a.find_next(12) == a.npos);
+    IT_ASSERT(a.find_last() == 12);
+    IT_ASSERT(a.find_next(a.npos) == a.npos);
+
+    std::mt19937 engine(3);
+    for (size_t len : {1, 7, 8, 9, 63, 64, 65, 130, 256, 1000}) {
+        for (int density : {0, 1, 10, 50}) {
+            ict::bitstring b(len);
+            for (size_t i = 0; i < len; ++i)
+                if (static_cast<int>(engine() % 100) < density)
+                    b.set(i);
+
+            std::vector<size_t> expected;
+            for (size_t i = 0; i < len; ++i)
+                if (b.at(i))
+                    expected.push_back(i);
+
+            IT_ASSERT(b.count() == expected.size());
+            IT_ASSERT(b.any() == !expected.empty());
+            IT_ASSERT(b.none() == expected.empty());
+
+            std::vector<size_t> found;
+            for (auto i = b.find_first(); i != b.npos; i = b.find_next(i))
+                found.push_back(i);
+            IT_ASSERT_MSG(len << ' ' << density, found == expected);
+            IT_ASSERT(b.find_last() ==
+                      (expected.empty() ? b.npos : expected.back()));
+
+            // bits past the end of a substring don't count
+            if (len > 3) {
+                auto c = b.substr(0, len - 3);
+                auto n = static_cast<size_t>(
+                    std::count_if(expected.begin(), expected.end(),
+                                  [&](size_t i) { return i < len - 3; }));
+                IT_ASSERT(c.count() == n);
+            }
+        }
+    }
+}
+
+namespace {
+std::vector<size_t> naive_find_all(const ict::bitstring_view &text,
+                                   const ict::bitstring_view &pat) {
+    std::vector<size_t> found;
+    for (size_t i = 0; i + pat.bit_size() <= text.bit_size(); ++i)
+        if (text.substr(i, pat.bit_size()) == pat)
+            found.push_back(i);
+    return found;
+}
+} // namespace
+
+void bitstring_unit::find_patterns() {
+    ict::bitstring a("@0001 1010 0110 1101 0");
+    ict::bitstring p("@1101");
+    IT_ASSERT(a.find(p) == 3);
+    IT_ASSERT(a.find(p, 4) == 9);
+    IT_ASSERT(a.find(p, 10) == 12);
+    IT_ASSERT(a.find(p, 13) == a.npos);
+    IT_ASSERT(a.find(p, 100) == a.npos);
+    IT_ASSERT(a.find_all(p) == std::vector<size_t>({3, 9, 12}));
+    IT_ASSERT(a.find(ict::bitstring()) == 0);
+    IT_ASSERT(a.find_all(ict::bitstring()).empty());
+    IT_ASSERT(p.find(a) == p.npos);
+    IT_ASSERT(a.find(a) == 0);
+
+    // overlapping matches are all reported
+    ict::bitstring ones("@1111 1111 1111 1111 1111");
+    IT_ASSERT(ones.find_all(ict::bitstring("@1111 1111 1111 1111")) ==
+              std::vector<size_t>({0, 1, 2, 3, 4}));
+
+    std::mt19937 engine(7);
+    for (size_t m : {1, 3, 8, 15, 16, 17, 24, 33, 64, 65, 100, 200}) {
+        for (size_t len : {m, m + 5, size_t(300), size_t(2000)}) {
+            // a sparse text keeps random patterns from always missing
+            ict::bitstring text(len);
+            for (size_t i = 0; i < len; ++i)
+                if (engine() % 4 == 0)
+                    text.set(i);
+            auto at = engine() % (len - m + 1);
+            auto pat = text.substr(at, m);
+
+            for (size_t off : {0, 3}) {
+                if (off >= len)
+                    continue;
+                ict::bitstring_view tv(text);
+                tv = tv.substr(off, len - off);
+                auto expected = naive_find_all(tv, pat);
+                IT_ASSERT_MSG(m << ' ' << len << ' ' << off,
+                              tv.find_all(pat) == expected);
+                IT_ASSERT(tv.find(pat) == (expected.empty()
+                                               ? ict::bitstring::npos
+                                               : expected.front()));
+                if (off == 0) {
+                    IT_ASSERT(text.find_all(pat) == expected);
+                    IT_ASSERT(
+                        std::find(expected.begin(), expected.end(), at) !=
+                        expected.end());
+                }
+                // a pattern taken from an odd bit offset
+                ict::bitstring shifted(m + 5);
+                ict::bit_copy_n(pat.bit_begin(), m, shifted.bit_begin() + 5);
+                auto sv = ict::bitstring_view(shifted).substr(5, m);
+                IT_ASSERT(tv.find_all(sv) == expected);
+            }
+        }
+    }
+}
+
+void bitstring_unit::find_near_patterns() {
+    ict::bitstring a("@0001 1010 0110 1101 0");
+    ict::bitstring p("@1101");
+    IT_ASSERT(a.find_all(p, 0) == a.find_all(p));
+    // 1001 at 6 is one bit off
+    IT_ASSERT(a.find_all(p, 1) == std::vector<size_t>({3, 6, 9, 12}));
+    IT_ASSERT(a.find_all(p, 4).size() == a.bit_size() - 3);
+    IT_ASSERT(a.find_all(ict::bitstring(), 2).empty());
+    IT_ASSERT(p.find_all(a, 2).empty());
+
+    IT_ASSERT_MSG("pattern too long", [&]() {
+        try {
+            a.find_all(ict::bitstring(65), 1);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+
+    std::mt19937 engine(11);
+    for (size_t m : {1, 7, 8, 16, 24, 31, 57, 63, 64}) {
+        for (size_t len : {m, m + 9, size_t(100), size_t(1000)}) {
+            auto text = ict::random_bitstring(len);
+            auto pat = text.substr(engine() % (len - m + 1), m);
+            for (size_t off : {0, 5}) {
+                if (off >= len)
+                    continue;
+                auto tv = ict::bitstring_view(text).substr(off, len - off);
+                for (size_t k : {0, 1, 3, 10}) {
+                    std::vector<size_t> expected;
+                    for (size_t i = 0; i + m <= tv.bit_size(); ++i) {
+                        size_t errors = 0;
+                        for (size_t b = 0; b < m; ++b)
+                            errors += tv.at(i + b) != pat.at(b);
+                        if (errors <= k)
+                            expected.push_back(i);
+                    }
+                    IT_ASSERT_MSG(m << ' ' << len << ' ' << off << ' ' << k,
+                                  tv.find_all(pat, k) == expected);
+                    if (off == 0)
+                        IT_ASSERT(text.find_all(pat, k) == expected);
+                }
+            }
+        }
+    }
+}
+
 } // namespace ict
 int main(int, char **) {
     ict::bitstring_unit test;
@@ -28,10 +28,35 @@ class bitstring_unit
         ut.add(&bitstring_unit::modern_replace);
         ut.add(&bitstring_unit::modern_pad);
         ut.add(&bitstring_unit::modern_gsm7);
+        ut.add(&bitstring_unit::gsm7_codec);
+        ut.add(&bitstring_unit::ascii7);
+        ut.add(&bitstring_unit::fixed_fields);
+        ut.add(&bitstring_unit::hashing);
+        ut.add(&bitstring_unit::interning);
+        ut.add(&bitstring_unit::raw_streams);
+        ut.add(&bitstring_unit::streaming);
+        ut.add(&bitstring_unit::deep_constraints);
+        ut.add(&bitstring_unit::checkpoints);
         ut.add(&bitstring_unit::modern_sms_difficult);
 
         ut.add(&bitstring_unit::bit_iterators);
         ut.add(&bitstring_unit::const_bit_iterators);
+        ut.add(&bitstring_unit::bit_copy_offsets);
+        ut.add(&bitstring_unit::random_access_iterators);
+        ut.add(&bitstring_unit::views);
+        ut.add(&bitstring_unit::ibs_integers);
+        ut.add(&bitstring_unit::obs_integers);
+        ut.add(&bitstring_unit::resources);
+        ut.add(&bitstring_unit::capacity);
+        ut.add(&bitstring_unit::parsing);
+        ut.add(&bitstring_unit::bitwise);
+        ut.add(&bitstring_unit::bit_queries);
+        ut.add(&bitstring_unit::find_patterns);
+        ut.add(&bitstring_unit::find_near_patterns);
+        ut.add(&bitstring_unit::crc_presets);
+        ut.add(&bitstring_unit::crc_bits);
+        ut.add(&bitstring_unit::checksums);
+        ut.add(&bitstring_unit::message_layouts);
 
         ut.skip();
         ut.cont();
@@ -55,8 +80,33 @@ class bitstring_unit
     void modern_pad();
     void modern_replace();
     void modern_gsm7();
+    void gsm7_codec();
+    void ascii7();
+    void fixed_fields();
+    void hashing();
+    void interning();
+    void raw_streams();
+    void streaming();
+    void deep_constraints();
+    void checkpoints();
     void modern_sms_difficult();
     void bit_iterators();
     void const_bit_iterators();
+    void bit_copy_offsets();
+    void random_access_iterators();
+    void views();
+    void ibs_integers();
+    void obs_integers();
+    void resources();
+    void capacity();
+    void parsing();
+    void bitwise();
+    void bit_queries();
+    void find_patterns();
+    void find_near_patterns();
+    void crc_presets();
+    void crc_bits();
+    void checksums();
+    void message_layouts();
 };
 }
@@ -0,0 +1,150 @@
+#include "bitstringunit.h"
+#include <crc.h>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+ict::bitstring ascii(const char *s) {
+    return ict::bitstring(ict::bit_iterator(const_cast<char *>(s)),
+                          std::strlen(s) * 8);
+}
+
+// A CRC one bit at a time, straight from the definition.
+uint64_t slow_crc(const ict::crc_spec &spec, const ict::bitstring_view &bits) {
+    const auto w = spec.width;
+    const uint64_t top = uint64_t(1) << (w - 1);
+    const uint64_t mask = w == 64 ? ~uint64_t(0) : (top << 1) - 1;
+    auto feed = [&](uint64_t reg, bool b) {
+        bool fb = ((reg & top) != 0) != b;
+        reg = (reg << 1) & mask;
+        return fb ? reg ^ spec.poly : reg;
+    };
+    uint64_t reg = spec.init & mask;
+    size_t n = bits.bit_size();
+    for (size_t i = 0; i < n; i += 8) {
+        auto len = std::min<size_t>(8, n - i);
+        for (size_t j = 0; j < len; ++j)
+            reg = feed(reg, bits.at(spec.refin ? i + len - 1 - j : i + j));
+    }
+    if (spec.refout) {
+        uint64_t r = 0;
+        for (unsigned i = 0; i < w; ++i)
+            r |= ((reg >> i) & 1) << (w - 1 - i);
+        reg = r;
+    }
+    return (reg ^ spec.xorout) & mask;
+}
+} // namespace
+
+void ict::bitstring_unit::crc_presets() {
+    auto check = ascii("123456789");
+    IT_ASSERT(ict::crc(ict::crc8)(check) == 0xF4);
+    IT_ASSERT(ict::crc(ict::crc16_ibm_3740)(check) == 0x29B1);
+    IT_ASSERT(ict::crc(ict::crc16_arc)(check) == 0xBB3D);
+    IT_ASSERT(ict::crc(ict::crc16_x25)(check) == 0x906E);
+    IT_ASSERT(ict::crc(ict::crc24_openpgp)(check) == 0x21CF02);
+    IT_ASSERT(ict::crc(ict::crc24_lte_a)(check) == 0xCDE703);
+    IT_ASSERT(ict::crc(ict::crc24_lte_b)(check) == 0x23EF52);
+    IT_ASSERT(ict::crc(ict::crc32)(check) == 0xCBF43926);
+    IT_ASSERT(ict::crc(ict::crc32c)(check) == 0xE3069283);
+
+    // CRC-64/XZ and CRC-5/USB from the catalogue
+    IT_ASSERT(ict::crc({64, 0x42F0E1EBA9EA3693, ~uint64_t(0), true, true,
+                        ~uint64_t(0)})(check) == 0x995DC9BBDF1939FA);
+    IT_ASSERT(ict::crc({5, 0x05, 0x1F, true, true, 0x1F})(check) == 0x19);
+
+    IT_ASSERT(ict::crc(ict::crc32)(ict::bitstring()) == 0);
+
+    IT_ASSERT_MSG("bad width", [&]() {
+        try {
+            ict::crc({0, 1, 0, false, false, 0});
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+}
+
+void ict::bitstring_unit::crc_bits() {
+    std::vector<ict::crc_spec> specs = {
+        ict::crc8,        ict::crc16_ibm_3740,
+        ict::crc16_arc,   ict::crc24_lte_a,
+        ict::crc32,       ict::crc32c,
+        {3, 0x3, 0x7, false, false, 0},
+        {12, 0x80F, 0, false, true, 0},
+        {64, 0x42F0E1EBA9EA3693, 0, false, false, 0},
+        {64, 0x42F0E1EBA9EA3693, ~uint64_t(0), true, true, ~uint64_t(0)}};
+    auto data = ict::random_bitstring(2000);
+    for (auto &spec : specs) {
+        ict::crc engine(spec);
+        for (size_t len : {0, 1, 5, 8, 13, 63, 64, 65, 72, 130, 512, 1001}) {
+            for (size_t off : {0, 1, 7, 8, 11}) {
+                auto v = ict::bitstring_view(data).substr(off, len);
+                IT_ASSERT_MSG(spec.width << ' ' << len << ' ' << off,
+                              engine(v) == slow_crc(spec, v));
+            }
+        }
+
+        // whole bytes at a time give the same result as one pass
+        auto v = ict::bitstring_view(data).substr(3, 1000);
+        auto reg = engine.start();
+        reg = engine.update(reg, v.substr(0, 136));
+        reg = engine.update(reg, v.substr(136, 8));
+        reg = engine.update(reg, v.substr(144));
+        IT_ASSERT(engine.finish(reg) == engine(v));
+    }
+
+    // a stream range, which is left where it was
+    auto msg = ascii("xx123456789");
+    ict::ibitstream is(msg);
+    is.seek(16);
+    ict::crc crc32(ict::crc32);
+    IT_ASSERT(crc32(is, 72) == 0xCBF43926);
+    IT_ASSERT(crc32(is, 1000) == 0xCBF43926);
+    IT_ASSERT(is.tellg() == 16);
+}
+
+void ict::bitstring_unit::checksums() {
+    // the RFC 1071 example
+    ict::bitstring ip("#0001F203F4F5F6F7");
+    IT_ASSERT(ict::internet_checksum(ip) == static_cast<uint16_t>(~0xDDF2));
+    // an odd byte is padded
+    IT_ASSERT(ict::internet_checksum(ict::bitstring("#0001F203F4F5F6")) ==
+              static_cast<uint16_t>(~(0xDDF2 - 0xF7)));
+    IT_ASSERT(ict::internet_checksum(ict::bitstring()) == 0xFFFF);
+    // a packet with its checksum filled in sums to zero
+    ict::bitstring with("#0001F203F4F5F6F7220D");
+    IT_ASSERT(ict::internet_checksum(with) == 0);
+
+    IT_ASSERT(ict::fletcher16(ascii("abcde")) == 0xC8F0);
+    IT_ASSERT(ict::fletcher16(ascii("abcdef")) == 0x2057);
+    IT_ASSERT(ict::fletcher16(ascii("abcdefgh")) == 0x0627);
+    IT_ASSERT(ict::fletcher32(ascii("abcde")) == 0xF04FC729);
+    IT_ASSERT(ict::fletcher32(ascii("abcdef")) == 0x56502D2A);
+    IT_ASSERT(ict::fletcher32(ascii("abcdefgh")) == 0xEBE19591);
+
+    // long and misaligned input against a byte at a time sum
+    auto data = ict::random_bitstring(8 * 40000 + 3);
+    auto v = ict::bitstring_view(data).substr(3);
+    auto bytes = v.bits();
+    uint32_t c0 = 0, c1 = 0;
+    for (size_t i = 0; i < bytes.byte_size(); ++i) {
+        c0 = (c0 + bytes.begin()[i]) % 255;
+        c1 = (c1 + c0) % 255;
+    }
+    IT_ASSERT(ict::fletcher16(v) == ((c1 << 8) | c0));
+    c0 = c1 = 0;
+    for (size_t i = 0; i < bytes.byte_size(); i += 2) {
+        c0 = (c0 + bytes.begin()[i] + (bytes.begin()[i + 1] << 8)) % 65535;
+        c1 = (c1 + c0) % 65535;
+    }
+    IT_ASSERT(ict::fletcher32(v) == ((c1 << 16) | c0));
+    uint64_t sum = 0;
+    for (size_t i = 0; i < bytes.byte_size(); i += 2)
+        sum += (bytes.begin()[i] << 8) | bytes.begin()[i + 1];
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    IT_ASSERT(ict::internet_checksum(v) == static_cast<uint16_t>(~sum));
+}
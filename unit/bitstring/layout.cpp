@@ -0,0 +1,192 @@
+#include "bitstringunit.h"
+#include <layout.h>
+
+namespace {
+struct ipv4 {
+    uint8_t version;
+    uint8_t ihl;
+    uint8_t dscp;
+    uint8_t ecn;
+    uint16_t length;
+    uint16_t id;
+    uint8_t flags;
+    uint16_t fragment;
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t checksum;
+    uint32_t source;
+    uint32_t destination;
+};
+
+using ipv4_layout = ict::layout<
+    ipv4, ict::field<&ipv4::version, 4>, ict::field<&ipv4::ihl, 4>,
+    ict::field<&ipv4::dscp, 6>, ict::field<&ipv4::ecn, 2>,
+    ict::field<&ipv4::length, 16>, ict::field<&ipv4::id, 16>,
+    ict::field<&ipv4::flags, 3>, ict::field<&ipv4::fragment, 13>,
+    ict::field<&ipv4::ttl, 8>, ict::field<&ipv4::protocol, 8>,
+    ict::field<&ipv4::checksum, 16>, ict::field<&ipv4::source, 32>,
+    ict::field<&ipv4::destination, 32>>;
+
+enum class kind : uint8_t { data = 1, control = 2, other = 7 };
+
+struct record {
+    kind type;
+    bool urgent;
+    uint8_t flags;
+    uint16_t ext;
+    int16_t delta;
+    uint64_t stamp;
+    uint32_t tail;
+};
+
+constexpr bool has_ext(const record &r) { return r.flags & 1; }
+constexpr bool has_stamp(const record &r) { return r.flags & 2; }
+
+using record_layout = ict::layout<
+    record, ict::field<&record::type, 3>, ict::field<&record::urgent, 1>,
+    ict::field<&record::flags, 2>, ict::pad<2>,
+    ict::optional_field<&record::ext, 11, has_ext>,
+    ict::field<&record::delta, 7>,
+    ict::optional_field<&record::stamp, 64, has_stamp>,
+    ict::field<&record::tail, 17>>;
+
+bool same(const record &a, const record &b) {
+    return a.type == b.type && a.urgent == b.urgent && a.flags == b.flags &&
+           a.ext == b.ext && a.delta == b.delta && a.stamp == b.stamp &&
+           a.tail == b.tail;
+}
+} // namespace
+
+void ict::bitstring_unit::message_layouts() {
+    static_assert(ipv4_layout::fixed_size, "fixed");
+    static_assert(ipv4_layout::min_bits == 160, "ipv4 size");
+    static_assert(!record_layout::fixed_size, "optional fields");
+    static_assert(record_layout::min_bits == 32, "record size");
+
+    ict::bitstring packet("#450005DC1C4640004006B1E6C0A80001C0A800C7");
+    auto h = ipv4_layout::decode(packet);
+    IT_ASSERT(h.version == 4);
+    IT_ASSERT(h.ihl == 5);
+    IT_ASSERT(h.length == 1500);
+    IT_ASSERT(h.id == 0x1C46);
+    IT_ASSERT(h.flags == 2);
+    IT_ASSERT(h.fragment == 0);
+    IT_ASSERT(h.ttl == 64);
+    IT_ASSERT(h.protocol == 6);
+    IT_ASSERT(h.checksum == 0xB1E6);
+    IT_ASSERT(h.source == 0xC0A80001);
+    IT_ASSERT(h.destination == 0xC0A800C7);
+    IT_ASSERT(ipv4_layout::encode(h) == packet);
+
+    // every field against a stream of reads, at every bit offset
+    auto data = ict::random_bitstring(160 + 8);
+    for (size_t off = 0; off < 8; ++off) {
+        auto v = ict::bitstring_view(data).substr(off, 160);
+        auto d = ipv4_layout::decode(v);
+        ict::bitstring copy(v.bits());
+        ict::ibitstream is(copy);
+        IT_ASSERT(d.version == is.read_uint(4));
+        IT_ASSERT(d.ihl == is.read_uint(4));
+        IT_ASSERT(d.dscp == is.read_uint(6));
+        IT_ASSERT(d.ecn == is.read_uint(2));
+        IT_ASSERT(d.length == is.read_uint(16));
+        IT_ASSERT(d.id == is.read_uint(16));
+        IT_ASSERT(d.flags == is.read_uint(3));
+        IT_ASSERT(d.fragment == is.read_uint(13));
+        IT_ASSERT(d.ttl == is.read_uint(8));
+        IT_ASSERT(d.protocol == is.read_uint(8));
+        IT_ASSERT(d.checksum == is.read_uint(16));
+        IT_ASSERT(d.source == is.read_uint(32));
+        IT_ASSERT(d.destination == is.read_uint(32));
+        IT_ASSERT(ipv4_layout::encode(d) == copy);
+    }
+
+    // optional fields, signed, enum and bool members
+    for (uint8_t flags = 0; flags < 4; ++flags) {
+        record r{kind::other, true, flags, 0, -37, 0, 0x1ABCD};
+        if (has_ext(r))
+            r.ext = 0x5A5;
+        if (has_stamp(r))
+            r.stamp = 0xFEDCBA9876543210;
+        auto bits = record_layout::encode(r);
+        IT_ASSERT(bits.bit_size() == record_layout::bit_size(r));
+        IT_ASSERT(bits.bit_size() == 32u + (flags & 1) * 11 + (flags & 2) * 32);
+        IT_ASSERT(same(record_layout::decode(bits), r));
+
+        ict::obitstream os;
+        record_layout::encode(os, r);
+        IT_ASSERT(os.bits() == bits);
+
+        // misaligned, and two back to back in a stream
+        auto twice = ict::bitstring("@101");
+        twice.append(bits);
+        twice.append(bits);
+        IT_ASSERT(same(record_layout::decode(
+                           ict::bitstring_view(twice).substr(3)),
+                       r));
+        ict::ibitstream is(twice);
+        is.seek(3);
+        IT_ASSERT(same(record_layout::decode(is), r));
+        IT_ASSERT(is.tellg() == 3 + bits.bit_size());
+        IT_ASSERT(same(record_layout::decode(is), r));
+        IT_ASSERT(is.eobits());
+
+        // and from a stream, which only peeks as far as a message can go
+        size_t pos = 0;
+        ict::ibitstream in(
+            [&](unsigned char *p, size_t n) {
+                n = std::min(n, twice.byte_size() - pos);
+                std::copy_n(twice.begin() + pos, n, p);
+                pos += n;
+                return n;
+            },
+            2);
+        in.seek(3);
+        IT_ASSERT(same(record_layout::decode(in), r));
+        IT_ASSERT(same(record_layout::decode(in), r));
+        IT_ASSERT(in.tellg() == 3 + 2 * bits.bit_size());
+    }
+
+    // padding is written as zeros and skipped on the way in
+    auto padded = record_layout::encode({kind::data, false, 0, 0, 0, 0, 0});
+    IT_ASSERT(padded == ict::bitstring("#20000000"));
+    padded.begin()[0] |= 0x03;
+    IT_ASSERT(record_layout::decode(padded).flags == 0);
+
+    IT_ASSERT_MSG("too short", [&]() {
+        try {
+            ipv4_layout::decode(ict::bitstring_view(packet).substr(0, 159));
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+    IT_ASSERT_MSG("optional field too short", [&]() {
+        try {
+            // flags say a 64 bit stamp follows
+            record_layout::decode(ict::bitstring("#48000000"));
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+    // a stream only finds its end in the peek, which must not read zeros
+    // past it
+    auto truncated = ict::bitstring("#48000000");
+    size_t pos = 0;
+    ict::ibitstream in([&](unsigned char *p, size_t n) {
+        n = std::min(n, truncated.byte_size() - pos);
+        std::copy_n(truncated.begin() + pos, n, p);
+        pos += n;
+        return n;
+    });
+    IT_ASSERT_MSG("streamed too short", [&]() {
+        try {
+            record_layout::decode(in);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+    IT_ASSERT(in.tellg() == 0 && in.remaining() == 32);
+}
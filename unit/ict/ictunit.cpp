@@ -1,6 +1,9 @@
 //-- Copyright 2016 Intrig
 //-- See https://github.com/intrig/ict for license.
 #include "ictunit.h"
+#include <cstdio>
+#include <ict.h>
+#include <mapped_file.h>
 #include <osstream.h>
 
 void ict_unit::osstream() {
@@ -26,6 +29,48 @@ void ict_unit::osstream() {
 #endif
 }
 
+void ict_unit::files() {
+    const std::string name = "ictunit_files.bin";
+    std::vector<char> data(100000);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<char>(i * 7 + i / 256);
+    ict::write_file(data.begin(), data.end(), name);
+    IT_ASSERT(ict::read_file(name) == data);
+    {
+        ict::mapped_file file(name);
+        IT_ASSERT(file.size() == data.size());
+        IT_ASSERT(file.bit_size() == data.size() * 8);
+        IT_ASSERT(std::equal(file.begin(), file.end(),
+                             reinterpret_cast<unsigned char *>(data.data())));
+
+        // moving hands over the mapping
+        auto moved = std::move(file);
+        IT_ASSERT(file.empty() && file.data() == nullptr);
+        IT_ASSERT(moved.size() == data.size());
+        IT_ASSERT(moved.data()[99999] == static_cast<unsigned char>(data[99999]));
+    }
+
+    // an empty file maps to nothing
+    ict::write_file(data.begin(), data.begin(), name);
+    IT_ASSERT(ict::read_file(name).empty());
+    {
+        ict::mapped_file file(name);
+        IT_ASSERT(file.empty());
+        IT_ASSERT(file.begin() == file.end());
+    }
+    std::remove(name.c_str());
+
+    IT_ASSERT(ict::read_file(name).empty());
+    IT_ASSERT_MSG("missing file", [&]() {
+        try {
+            ict::mapped_file file(name);
+        } catch (std::exception &) {
+            return true;
+        }
+        return false;
+    }());
+}
+
 int main (int, char **)
 {
     ict_unit test;
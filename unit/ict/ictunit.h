@@ -14,6 +14,7 @@ class ict_unit
         ut.add(&ict_unit::cloned_derived);
         ut.add(&ict_unit::cloned_vector);
         ut.add(&ict_unit::cloned_multivector);
+        ut.add(&ict_unit::files);
     }
 
     void osstream();
@@ -21,4 +22,5 @@ class ict_unit
     void cloned_derived();
     void cloned_vector();
     void cloned_multivector();
+    void files();
 };
@@ -3,6 +3,7 @@
 #include <random>
 #include <string64.h>
 #include <string>
+#include <unordered_set>
 
 struct spaces_t {
     char const *spaced;
@@ -94,6 +95,28 @@ void string64_unit::string64_compare() {
     IT_ASSERT(sorted == sorted2);
 }
 
+void string64_unit::string64_hash() {
+    std::hash<ict::string64> h;
+    IT_ASSERT(h("hello") == h(std::string("hello")));
+    IT_ASSERT(h("hello") != h("hellp"));
+    IT_ASSERT(h("") != h("a"));
+
+    // short names that differ in one character spread over the table
+    std::unordered_set<ict::string64> names;
+    std::unordered_set<size_t> hashes;
+    for (char a = 'a'; a <= 'z'; ++a) {
+        for (char b = '0'; b <= '9'; ++b) {
+            char name[] = {'p', 'd', 'u', a, b, '\0'};
+            names.insert(name);
+            hashes.insert(h(name));
+        }
+    }
+    IT_ASSERT(names.size() == 260);
+    IT_ASSERT(hashes.size() == 260);
+    IT_ASSERT(names.count("pduq7") == 1);
+    IT_ASSERT(names.count("pdu77") == 0);
+}
+
 int main() {
     string64_unit test;
     ict::unit_test<string64_unit> ut(&test);
@@ -6,9 +6,11 @@ struct string64_unit {
         ut.add(&string64_unit::squash);
         ut.add(&string64_unit::string64);
         ut.add(&string64_unit::string64_compare);
+        ut.add(&string64_unit::string64_hash);
     }
 
     void squash();
     void string64();
     void string64_compare();
+    void string64_hash();
 };